@@ -10,8 +10,29 @@
 #include <vector>
 #include <unordered_map>
 #include <unordered_set>
+#include <deque>
 #include <string>
-#include <regex>
+#include <string_view>
+#include <algorithm>
+#include <tuple>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <shared_mutex>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <chrono>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 /* Funkcje użytkowe i stałe */
 
@@ -27,7 +48,7 @@ uint time_to_minutes(const int hour, const int minutes) {
 
 // Funkcja konwertująca string z opisem godziny do minut.
 // Godzina jest podana w formacie hh:mm albo h:mm.
-int string_to_time(const std::string &time) {
+int string_to_time(const std::string_view time) {
     uint minutes = char_to_int(time[time.size() - 1]) + 10 * char_to_int(time[time.size() - 2]);
     uint hours = char_to_int(time[0]);
     if (time[1] != ':') {
@@ -36,17 +57,11 @@ int string_to_time(const std::string &time) {
     return time_to_minutes(hours, minutes);
 }
 
-void set_array_to(const int value, const uint size, int tab[]) {
-    for (uint i = 0; i < size; i++) {
-        tab[i] = value;
-    }
-}
-
 // Funkcja konwertująca string do liczby całkowitej
 // Ignoruje napotkane kropki - liczby zmiennoprzecinkowe traktuje jak całkowite
 // Argument text musi być poprawną liczbą całkowitą lub zmiennoprzecinkową
 // zapisaną jako tekst
-unsigned long long string_to_ull(const std::string &text) {
+unsigned long long string_to_ull(const std::string_view text) {
     unsigned long long power = 1;
     unsigned long long result = 0;
     for (int i = text.size() - 1; i >= 0; i--) {
@@ -57,10 +72,140 @@ unsigned long long string_to_ull(const std::string &text) {
     return result;
 }
 
-// Wypisuje na standardowe wyjście diagnostyczne informację o błędzie
-// w podanej linii oraz podaną linię.
-void call_error(const int line_number, std::string &line) {
-    std::cerr << "Error in line " << line_number << ": " << line << "\n";
+/* Statystyki */
+
+// Przyczyny błędów w liniach wejścia
+enum error_cause {
+    SYNTAX_ERROR, DUPLICATE_COURSE, INVALID_TIME, REPEATED_STOP, DUPLICATE_TICKET,
+    UNKNOWN_COURSE, STOP_NOT_ON_COURSE, WRONG_ORDER, INVALID_JOURNEY, ERROR_CAUSES
+};
+
+// Liczniki i pomiary czasu są kompilowane tylko z flagą KASA_STATS.
+// Bez niej makra STATS_ADD i STATS_TIMER nie generują żadnego kodu.
+#ifdef KASA_STATS
+
+const char *error_cause_names[ERROR_CAUSES] = {
+        "syntax", "duplicate course", "invalid time", "repeated stop", "duplicate ticket",
+        "unknown course", "stop not on course", "wrong order", "invalid journey"
+};
+
+// Rodzaje linii wejścia
+enum line_type {
+    EMPTY_LINE, COURSE_LINE, TICKET_LINE, QUERY_LINE, PLAN_LINE, INVALID_LINE, LINE_TYPES
+};
+
+const char *line_type_names[LINE_TYPES] = {"empty", "course", "ticket", "query", "plan", "invalid"};
+
+// Mierzone etapy działania programu
+enum phase {
+    EXECUTE_LINE, COURSE_ADDING, TICKET_ADDING, COURSE_QUERY, JOURNEY_PLANNING, REBUILD_SOLUTIONS, PHASES
+};
+
+const char *phase_names[PHASES] = {
+        "execute_line", "course adding", "ticket adding", "course query", "journey planning",
+        "rebuild_solutions"
+};
+
+// Liczniki są atomowe, bo w trybie wielowątkowym i w trybie serwera
+// zwiększa je wiele wątków naraz.
+struct statistics {
+    std::atomic<unsigned long long> lines[LINE_TYPES];
+    std::atomic<unsigned long long> errors[ERROR_CAUSES];
+    std::atomic<unsigned long long> solver_iterations;
+    std::atomic<unsigned long long> scanned_connections;
+    std::atomic<unsigned long long> phase_calls[PHASES];
+    std::atomic<unsigned long long> phase_ns[PHASES];
+} stats;
+
+// Dolicza czas życia obiektu do czasu etapu.
+class phase_timer {
+    private:
+        phase measured;
+        std::chrono::steady_clock::time_point start;
+
+    public:
+        explicit phase_timer(const phase measured) : measured(measured), start(std::chrono::steady_clock::now()) {}
+
+        ~phase_timer() {
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            stats.phase_calls[measured] += 1;
+            stats.phase_ns[measured] += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        }
+};
+
+// Ustawiane przez sygnał SIGUSR1 - podsumowanie zostanie wypisane po
+// rozpatrzeniu bieżącej linii.
+volatile sig_atomic_t stats_requested;
+
+void request_statistics(int) {
+    stats_requested = 1;
+}
+
+// Wypisuje podsumowanie statystyk do pliku wskazanego zmienną środowiskową
+// KASA_STATS_FILE albo na standardowe wyjście diagnostyczne.
+void report_statistics() {
+    const char *path = getenv("KASA_STATS_FILE");
+    FILE *file = path != nullptr ? fopen(path, "a") : nullptr;
+    FILE *out = file != nullptr ? file : stderr;
+
+    fprintf(out, "lines:");
+    for (int i = 0; i < LINE_TYPES; i++) {
+        fprintf(out, " %s %llu", line_type_names[i], stats.lines[i].load());
+    }
+    fprintf(out, "\nerrors:");
+    for (int i = 0; i < ERROR_CAUSES; i++) {
+        fprintf(out, " %s %llu", error_cause_names[i], stats.errors[i].load());
+    }
+    fprintf(out, "\nsolver iterations: %llu, scanned connections: %llu\n",
+            stats.solver_iterations.load(), stats.scanned_connections.load());
+    for (int i = 0; i < PHASES; i++) {
+        unsigned long long calls = stats.phase_calls[i], ns = stats.phase_ns[i];
+        fprintf(out, "%s: %llu calls, %llu ns total, %llu ns per call\n", phase_names[i], calls, ns,
+                calls == 0 ? 0 : ns / calls);
+    }
+    if (file != nullptr) {
+        fclose(file);
+    }
+}
+
+#define STATS_ADD(counter, value) (stats.counter += (value))
+#define STATS_TIMER(measured) phase_timer measured##_timer(measured)
+
+#else
+
+#define STATS_ADD(counter, value) ((void) 0)
+#define STATS_TIMER(measured) ((void) 0)
+
+#endif
+
+// Bufory na odpowiedzi programu i komunikaty o błędach. W trybie zwykłym są
+// opróżniane po każdej linii wejścia, w trybie wsadowym dopiero na końcu
+// działania programu, a w trybie wielowątkowym każdy wątek ma własne bufory,
+// których zawartość trafia do wyników rozpatrywanych linii.
+thread_local std::string output_buffer;
+thread_local std::string error_buffer;
+
+// Dopisuje do bufora błędów informację o błędzie w podanej linii oraz
+// podaną linię, zliczając przyczynę błędu.
+void call_error(const int line_number, const std::string_view line, const error_cause cause) {
+    STATS_ADD(errors[cause], 1);
+    (void) cause;
+    error_buffer.append("Error in line ");
+    error_buffer.append(std::to_string(line_number));
+    error_buffer.append(": ");
+    error_buffer.append(line);
+    error_buffer.append("\n");
+}
+
+void write_output(const std::string_view text) {
+    output_buffer.append(text);
+}
+
+void flush_output() {
+    std::cerr.write(error_buffer.data(), error_buffer.size());
+    error_buffer.clear();
+    std::cout.write(output_buffer.data(), output_buffer.size());
+    output_buffer.clear();
 }
 
 /* Funkcje obsługi rozkładu jazdy */
@@ -71,29 +216,140 @@ std::unordered_map<int, int> line_id;
 // Liczba kursów tramwajowych
 unsigned number_of_courses;
 
-// Przechowywanie linii tramwajowych
-// Dla każdej linii(kursu) trzymamy godzinę przyjazdu na przystanek
-std::vector<std::unordered_map<std::string, unsigned>> timetable;
+// Brak przystanku lub czasu przyjazdu
+const unsigned NO_STOP = -1;
+const unsigned NO_TIME = -1;
 
-// Opis biletu - dla każdej nazwy trzymamy cenę i czas ważności
-std::vector<std::pair<std::string, std::pair<unsigned, int>>> tickets;
+// Nazwy przystanków - identyfikator przystanku to indeks jego nazwy.
+// Deque nie przenosi elementów, więc widoki w stop_id pozostają ważne.
+std::deque<std::string> stop_names;
 
-long long sold_tickets;
+// Identyfikatory przystanków dla ich nazw
+std::unordered_map<std::string_view, unsigned> stop_id;
 
-// Sprawdza, czy dany numer linii kursu tramwajowego zatrzymuje się o danej godzinie na przystanku.
-bool stop_exists(int number_of_the_line, std::string name_of_the_stop, unsigned time) {
-    // nie istnieje taka linia tramwajowa
-    if (line_id.find(number_of_the_line) == line_id.end()) {
-        return false;
+// Przechowywanie linii tramwajowych w jednej tablicy: kurs o identyfikatorze
+// id zajmuje przedział [course_begin[id], course_begin[id + 1]) tablicy
+// course_stops, w którym trzymamy pary (identyfikator przystanku, godzina
+// przyjazdu) posortowane po identyfikatorze przystanku.
+std::vector<std::pair<unsigned, unsigned>> course_stops;
+std::vector<unsigned> course_begin = {0};
+
+// Zwraca identyfikator przystanku o podanej nazwie lub NO_STOP,
+// jeśli przez ten przystanek nie przejeżdża żaden kurs.
+unsigned find_stop(const std::string_view name) {
+    auto it = stop_id.find(name);
+    return it == stop_id.end() ? NO_STOP : it->second;
+}
+
+// Zwraca identyfikator przystanku o podanej nazwie, w razie potrzeby
+// nadając mu nowy.
+unsigned intern_stop(const std::string_view name) {
+    unsigned id = find_stop(name);
+    if (id == NO_STOP) {
+        id = stop_names.size();
+        stop_names.emplace_back(name);
+        stop_id[stop_names.back()] = id;
     }
-    int id = line_id[number_of_the_line];
-    if (timetable[id][name_of_the_stop] == time) {
-        return true;
-    } else {
-        return false;
+    return id;
+}
+
+// Zwraca godzinę przyjazdu kursu o identyfikatorze course na przystanek stop
+// lub NO_TIME, jeśli kurs nie zatrzymuje się na tym przystanku (również gdy
+// stop to NO_STOP).
+unsigned arrival_time(const unsigned course, const unsigned stop) {
+    auto begin = course_stops.begin() + course_begin[course];
+    auto end = course_stops.begin() + course_begin[course + 1];
+    auto it = std::lower_bound(begin, end, std::make_pair(stop, 0u));
+    return it != end && it->first == stop ? it->second : NO_TIME;
+}
+
+// Brak połączenia
+const size_t NO_CONNECTION = -1;
+
+// Połączenie - przejazd kursu między kolejnymi przystankami jego trasy.
+struct connection {
+    unsigned departure_minute;
+    unsigned arrival_minute;
+    unsigned from;
+    unsigned to;
+    unsigned course;
+
+    bool operator<(const connection &other) const {
+        return departure_minute < other.departure_minute;
     }
+};
+
+// Wszystkie połączenia posortowane po godzinie odjazdu. Połączenia nowych
+// kursów są dopisywane na koniec i włączane do posortowanej części dopiero
+// przed skanowaniem, bo kursy są zwykle dodawane przed zapytaniami.
+std::vector<connection> connections;
+size_t sorted_connections;
+
+// Zatrzymanie kursu na przystanku - przystanek, godzina, identyfikator kursu
+// i numer przystanku na trasie kursu (licząc od 0).
+struct departure {
+    unsigned stop;
+    unsigned minute;
+    unsigned course;
+    unsigned position;
+
+    bool operator<(const departure &other) const {
+        return std::tie(stop, minute, course) < std::tie(other.stop, other.minute, other.course);
+    }
+};
+
+// Indeks zatrzymań - zatrzymania wszystkich kursów posortowane po
+// przystanku, godzinie i kursie. Tak jak połączenia, zatrzymania nowych
+// kursów są dopisywane na koniec i sortowane dopiero przed użyciem.
+std::vector<departure> departures;
+size_t sorted_departures;
+
+// Numery kursów dla ich identyfikatorów
+std::vector<unsigned> course_numbers;
+
+// Sortuje elementy tablicy dopisane po pierwszych sorted elementach
+// i scala je z nimi.
+template<typename T>
+void merge_appended(std::vector<T> &items, size_t &sorted) {
+    if (sorted == items.size()) {
+        return;
+    }
+    auto middle = items.begin() + sorted;
+    std::stable_sort(middle, items.end());
+    std::inplace_merge(items.begin(), middle, items.end());
+    sorted = items.size();
 }
 
+// Sortuje połączenia i zatrzymania dopisane od ostatniego wywołania.
+void sort_timetable() {
+    merge_appended(connections, sorted_connections);
+    merge_appended(departures, sorted_departures);
+}
+
+// Zwraca przedział indeksu zatrzymań na przystanku stop dokładnie o godzinie
+// minute. Indeks musi być posortowany.
+std::pair<std::vector<departure>::const_iterator, std::vector<departure>::const_iterator>
+departures_at(const unsigned stop, const unsigned minute) {
+    return std::equal_range(departures.cbegin(), departures.cend(), departure{stop, minute, 0, 0},
+                            [](const departure &a, const departure &b) {
+                                return std::tie(a.stop, a.minute) < std::tie(b.stop, b.minute);
+                            });
+}
+
+// Sprawdza, czy o godzinie minute z przystanku stop odjeżdża jakiś kurs,
+// czyli czy stop nie jest tam jego ostatnim przystankiem.
+bool departs_at(const unsigned stop, const unsigned minute) {
+    auto [begin, end] = departures_at(stop, minute);
+    return std::any_of(begin, end, [](const departure &entry) {
+        return course_begin[entry.course] + entry.position + 1 < course_begin[entry.course + 1];
+    });
+}
+
+// Opis biletu - dla każdej nazwy trzymamy cenę i czas ważności
+std::vector<std::pair<std::string, std::pair<unsigned, int>>> tickets;
+
+std::atomic<long long> sold_tickets;
+
 // Funkcja sprawdzająca czy podany czas dojazdu na przystanek mieści
 // się w przedziale (bottom_limit, koniec pracy tramwajów]
 bool valid_minutes(unsigned bottom_limit, unsigned minutes) {
@@ -115,7 +371,7 @@ int duration_of_ticket(const int id) {
     return tickets[id].second.second;
 }
 
-std::string name_of_ticket(const int id) {
+const std::string &name_of_ticket(const int id) {
     return tickets[id].first;
 }
 
@@ -126,302 +382,1426 @@ bool check_if_exists(const std::string name) {
     return false;
 }
 
-// Funkcja dla podanego tekstu i wzorca znajduje pierwsze wystąpienie
-// wzorca w tekscie, zwraca je oraz modfikuje tekst w taki sposób, że
-// po jej wywołaniu jest on swoim sufiksem zaczynającym się za wystąpieniem wzorca
-std::string first_match(std::string &text, std::regex &r) {
-    std::smatch match;
-    std::regex_search(text, match, r);
-    std::string res = match.str(0);
-    text = match.suffix().str();
+/* Wczytywanie komend */
+
+bool is_digit(const char c) {
+    return '0' <= c && c <= '9';
+}
+
+bool is_letter(const char c) {
+    return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z');
+}
+
+// Znaki dozwolone w nazwie przystanku: [a-zA-Z_^]
+bool is_stop_char(const char c) {
+    return is_letter(c) || c == '_' || c == '^';
+}
+
+// Znaki dozwolone w nazwie biletu: [a-zA-Z ]
+bool is_ticket_name_char(const char c) {
+    return is_letter(c) || c == ' ';
+}
+
+// Odcina z początku tekstu najdłuższy prefiks złożony ze znaków
+// spełniających predykat i zwraca go. Nie kopiuje tekstu.
+template<typename Predicate>
+std::string_view take_while(std::string_view &text, Predicate predicate) {
+    size_t length = 0;
+    while (length < text.size() && predicate(text[length])) {
+        length++;
+    }
+    std::string_view res = text.substr(0, length);
+    text.remove_prefix(length);
     return res;
 }
 
-/* Rozwiązanie w n^3 */
+// Jeśli tekst zaczyna się od znaku c, odcina go i zwraca true.
+bool take_char(std::string_view &text, const char c) {
+    if (text.empty() || text[0] != c) {
+        return false;
+    }
+    text.remove_prefix(1);
+    return true;
+}
 
-void create_output(const int id_st, const int id_nd, const int id_rd) {
-    if (id_st == -1) {
-        std::cout << ":-|\n";
-    } else if (id_nd == -1) {
-        std::cout << "! " << name_of_ticket(id_st) << "\n";
-        sold_tickets += 1;
-    } else if (id_rd == -1) {
-        std::cout << "! " << name_of_ticket(id_st) << "; " << name_of_ticket(id_nd) << "\n";
-        sold_tickets += 2;
-    } else {
-        std::cout << "! " << name_of_ticket(id_st) << "; " << name_of_ticket(id_nd) << "; " << name_of_ticket(id_rd)
-                  << "\n";
-        sold_tickets += 3;
+// Odcina z początku tekstu godzinę w formacie h:mm albo hh:mm
+// z zakresu 1:00 - 23:59 i zapisuje ją w minutach.
+bool take_time(std::string_view &text, unsigned &minutes) {
+    std::string_view hour = take_while(text, is_digit);
+    if (hour.empty() || hour.size() > 2 || hour[0] == '0'
+        || (hour.size() == 2 && (hour[0] > '2' || (hour[0] == '2' && hour[1] > '3')))) {
+        return false;
+    }
+    if (!take_char(text, ':')) {
+        return false;
+    }
+    std::string_view minute = take_while(text, is_digit);
+    if (minute.size() != 2 || minute[0] > '5') {
+        return false;
+    }
+    minutes = time_to_minutes(string_to_ull(hour), string_to_ull(minute));
+    return true;
+}
+
+// Odcina z początku tekstu spację oraz niepustą nazwę przystanku.
+bool take_stop(std::string_view &text, std::string_view &stop) {
+    if (!take_char(text, ' ')) {
+        return false;
+    }
+    stop = take_while(text, is_stop_char);
+    return !stop.empty();
+}
+
+// Rozkład kursu wczytany z linii - numer kursu oraz kolejne pary
+// (czas przyjazdu, nazwa przystanku).
+struct course_line {
+    unsigned number;
+    std::vector<std::pair<unsigned, std::string_view>> stops;
+};
+
+// Bilet wczytany z linii - nazwa, cena w groszach i czas ważności.
+struct ticket_line {
+    std::string_view name;
+    int price;
+    int duration;
+};
+
+// Zapytanie wczytane z linii - przystanek początkowy oraz kolejne pary
+// (numer kursu, przystanek).
+struct query_line {
+    std::string_view start;
+    std::vector<std::pair<unsigned, std::string_view>> legs;
+};
+
+// Zapytanie o podróż wczytane z linii - przystanek początkowy, godzina
+// odjazdu i przystanek docelowy.
+struct plan_line {
+    std::string_view start;
+    unsigned minutes;
+    std::string_view destination;
+};
+
+// Rozpoznaje linię postaci "numer (godzina przystanek){2,}".
+bool parse_course(std::string_view text, course_line &course) {
+    std::string_view number = take_while(text, is_digit);
+    if (number.empty()) {
+        return false;
+    }
+    course.number = string_to_ull(number);
+    course.stops.clear();
+    while (!text.empty()) {
+        unsigned minutes;
+        std::string_view stop;
+        if (!take_char(text, ' ') || !take_time(text, minutes) || !take_stop(text, stop)) {
+            return false;
+        }
+        course.stops.emplace_back(minutes, stop);
     }
+    return course.stops.size() >= 2;
 }
 
-unsigned calculate_cost(const int id_st, const int id_nd, const int id_rd) {
-    unsigned price = MAX_INT;
-    if (id_st != -1) {
-        price = price_of_ticket(id_st);
+// Rozpoznaje linię postaci "nazwa cena czas_ważności", gdzie nazwa składa
+// się z liter i spacji, cena ma dokładnie dwie cyfry po kropce,
+// a czas ważności jest liczbą dodatnią bez zer wiodących.
+bool parse_ticket(std::string_view text, ticket_line &ticket) {
+    std::string_view name = take_while(text, is_ticket_name_char);
+    // Nazwa jest oddzielona od ceny ostatnią wczytaną spacją.
+    if (name.size() < 2 || name.back() != ' ') {
+        return false;
     }
-    if (id_nd != -1) {
-        price += price_of_ticket(id_nd);
+    ticket.name = name.substr(0, name.size() - 1);
+
+    std::string_view price = text;
+    std::string_view integral = take_while(text, is_digit);
+    if (integral.empty() || !take_char(text, '.') || take_while(text, is_digit).size() != 2) {
+        return false;
     }
-    if (id_rd != -1) {
-        price += price_of_ticket(id_rd);
+    price = price.substr(0, price.size() - text.size());
+    if (!take_char(text, ' ')) {
+        return false;
     }
-    return price;
+    std::string_view duration = take_while(text, is_digit);
+    if (duration.empty() || duration[0] == '0' || !text.empty()) {
+        return false;
+    }
+    ticket.price = string_to_ull(price);
+    ticket.duration = string_to_ull(duration);
+    return true;
 }
 
-int calculate_time(const int id_st, const int id_nd, const int id_rd) {
-    int time = 0;
-    if (id_st != -1) {
-        time += duration_of_ticket(id_st);
+// Rozpoznaje linię postaci "? przystanek (numer_kursu przystanek)+".
+bool parse_query(std::string_view text, query_line &query) {
+    if (!take_char(text, '?') || !take_stop(text, query.start)) {
+        return false;
     }
-    if (id_nd != -1) {
-        time += duration_of_ticket(id_nd);
+    query.legs.clear();
+    while (!text.empty()) {
+        std::string_view number, stop;
+        if (!take_char(text, ' ')) {
+            return false;
+        }
+        number = take_while(text, is_digit);
+        if (number.empty() || !take_stop(text, stop)) {
+            return false;
+        }
+        query.legs.emplace_back(string_to_ull(number), stop);
+    }
+    return !query.legs.empty();
+}
+
+// Rozpoznaje linię postaci "? przystanek godzina przystanek".
+bool parse_plan(std::string_view text, plan_line &plan) {
+    return take_char(text, '?') && take_stop(text, plan.start) && take_char(text, ' ')
+           && take_time(text, plan.minutes) && take_stop(text, plan.destination) && text.empty();
+}
+
+/* Rozwiązanie - tablica najtańszych zestawów biletów */
+
+// Najdłuższy możliwy czas przejazdu - od 5:55 do 21:21 włącznie.
+const int MAX_DURATION = time_to_minutes(21, 21) - time_to_minutes(5, 55) + 1;
+
+// Maksymalna liczba biletów kupowanych na jeden przejazd
+#ifndef MAX_TICKETS
+#define MAX_TICKETS 3
+#endif
+
+// Koszt oznaczający brak zestawu biletów.
+const unsigned long long NO_COST = -1;
+
+// Zestaw co najwyżej MAX_TICKETS biletów wraz z łącznym kosztem.
+// Brak biletu na danej pozycji oznaczamy przez -1.
+struct combination {
+    unsigned long long cost;
+    int id[MAX_TICKETS];
+};
+
+// Zwraca zestaw bez biletów o podanym koszcie.
+combination empty_combination(const unsigned long long cost) {
+    combination res;
+    res.cost = cost;
+    std::fill(res.id, res.id + MAX_TICKETS, -1);
+    return res;
+}
+
+const combination NO_COMBINATION = empty_combination(NO_COST);
+const combination EMPTY_COMBINATION = empty_combination(0);
+
+// Tablica zestawów biletów indeksowana czasem przejazdu
+using solution_table = std::vector<combination>;
+
+// Dla każdego czasu d od 0 do MAX_DURATION trzymamy najtańszy zestaw
+// co najwyżej MAX_TICKETS biletów ważny łącznie co najmniej d minut.
+// Tablica jest przeliczana po każdym dodaniu biletu, dzięki czemu zapytanie
+// jest pojedynczym odczytem. Tablica best_solution nie jest nigdy
+// modyfikowana, tylko zastępowana nową, więc zapytanie może korzystać
+// z tablicy z chwili jego wczytania.
+std::shared_ptr<const solution_table> best_solution =
+        std::make_shared<const solution_table>(MAX_DURATION + 1, NO_COMBINATION);
+
+// Czas ważności biletu przycięty do MAX_DURATION - dłuższy bilet i tak
+// pokrywa każdy możliwy przejazd.
+int capped_duration(const int id) {
+    return std::min(duration_of_ticket(id), MAX_DURATION);
+}
+
+// Bilety niezdominowane - posortowane po czasie ważności (przyciętym do
+// MAX_DURATION), a przy równych czasach po cenie. Bilet jest zdominowany,
+// jeśli istnieje bilet tańszy i ważny co najmniej tak samo długo - zastąpienie
+// go takim biletem daje tańszy zestaw, więc zdominowany bilet nie należy do
+// żadnego najtańszego zestawu. Bilety równie drogie nie są usuwane, bo mogą
+// zostać wybrane przy remisie. W posortowanym ciągu ceny nie maleją.
+std::vector<int> ticket_frontier;
+
+// Porządek biletów w ticket_frontier
+bool frontier_less(const int first, const int second) {
+    return std::make_pair(capped_duration(first), price_of_ticket(first))
+           < std::make_pair(capped_duration(second), price_of_ticket(second));
+}
+
+// Dodaje bilet id do ticket_frontier, jeśli nie jest zdominowany, i usuwa
+// bilety przez niego zdominowane. Bilet zdominowany przez usunięty bilet
+// jest zdominowany także przez id, więc zbiór jest zawsze aktualny.
+void update_frontier(const int id) {
+    // Najtańszy bilet ważny co najmniej tak długo jak id to pierwszy bilet
+    // o czasie ważności nie mniejszym od czasu id.
+    auto longer = std::partition_point(ticket_frontier.begin(), ticket_frontier.end(),
+                                       [id](int other) { return capped_duration(other) < capped_duration(id); });
+    if (longer != ticket_frontier.end() && price_of_ticket(*longer) < price_of_ticket(id)) {
+        return;
     }
-    if (id_rd != -1) {
-        time += duration_of_ticket(id_rd);
+    // Bilety zdominowane przez id to droższe bilety ważne co najwyżej tak
+    // długo jak id.
+    auto not_longer_end = std::partition_point(longer, ticket_frontier.end(),
+                                               [id](int other) { return capped_duration(other) == capped_duration(id); });
+    auto dominated = std::remove_if(ticket_frontier.begin(), not_longer_end, [id](int other) {
+        return price_of_ticket(other) > price_of_ticket(id);
+    });
+    ticket_frontier.erase(dominated, not_longer_end);
+    ticket_frontier.insert(std::upper_bound(ticket_frontier.begin(), ticket_frontier.end(), id, frontier_less), id);
+}
+
+// Zwraca zestaw z tablicy table pokrywający co najmniej time minut
+// lub NO_COMBINATION, jeśli takiego czasu nie da się pokryć.
+combination lookup(const solution_table &table, const int time) {
+    if (time > MAX_DURATION) {
+        return NO_COMBINATION;
     }
-    return time;
+    return table[std::max(time, 0)];
 }
 
-void change(unsigned &value, const int time, int &st, int &nd, int &rd, int ticket_st, int ticket_nd, int ticket_rd) {
-    if (calculate_cost(ticket_st, ticket_nd, ticket_rd) <= value) {
-        if (calculate_time(ticket_st, ticket_nd, ticket_rd) >= time) {
-            st = ticket_st;
-            nd = ticket_nd;
-            rd = ticket_rd;
-            value = calculate_cost(st, nd, rd);
+// Pierwotne rozwiązanie przeglądało w porządku leksykograficznym wszystkie
+// ciągi MAX_TICKETS biletów i dla każdego sprawdzało wszystkie jego
+// prefiksy, zastępując wynik każdym zestawem nie droższym od dotychczasowego.
+// Zestaw krótszy niż MAX_TICKETS był więc sprawdzany ostatni raz przy
+// ciągu dopełnionym ostatnim biletem, przed dłuższymi prefiksami tego ciągu.
+// Funkcja zwraca true, jeśli zestaw first był sprawdzany ostatni raz
+// później niż zestaw second.
+bool later_in_search(const combination &first, const combination &second) {
+    int last = tickets.size() - 1;
+    int size_first = 0, size_second = 0;
+    for (int i = 0; i < MAX_TICKETS; i++) {
+        int a = first.id[i] == -1 ? last : first.id[i];
+        int b = second.id[i] == -1 ? last : second.id[i];
+        if (a != b) {
+            return a > b;
         }
+        size_first += first.id[i] != -1;
+        size_second += second.id[i] != -1;
     }
+    return size_first > size_second;
 }
 
-void create_solution(const int duration) {
-    int none = -1;
-    unsigned best_val = MAX_INT;
-    int st = none, nd = none, rd = none;
-    for (uint i = 0; i < tickets.size(); i++) {
-        for (uint j = 0; j < tickets.size(); j++) {
-            for (uint k = 0; k < tickets.size(); k++) {
-                change(best_val, duration, st, nd, rd, i, none, none);
-                change(best_val, duration, st, nd, rd, i, j, none);
-                change(best_val, duration, st, nd, rd, i, j, k);
+// Sprawdza, czy zestaw first jest lepszy od zestawu second - tańszy lub
+// równie drogi i wybierany później przez pierwotne rozwiązanie.
+bool better(const combination &first, const combination &second) {
+    if (first.cost != second.cost) {
+        return first.cost < second.cost;
+    }
+    return first.cost != NO_COST && later_in_search(first, second);
+}
+
+// Dokłada bilet id na początek zestawu rest, który ma mniej niż
+// MAX_TICKETS biletów.
+combination prepend(const int id, const combination &rest) {
+    if (rest.cost == NO_COST) {
+        return NO_COMBINATION;
+    }
+    combination res;
+    res.cost = rest.cost + price_of_ticket(id);
+    res.id[0] = id;
+    std::copy(rest.id, rest.id + MAX_TICKETS - 1, res.id + 1);
+    return res;
+}
+
+// Przelicza tablicę best_solution programowaniem dynamicznym po liczbie
+// biletów: zestaw co najwyżej k biletów pokrywający time minut to pierwszy
+// bilet i zestaw co najwyżej k - 1 biletów pokrywający resztę czasu.
+// Dla ustalonego pierwszego biletu najlepsza jest najlepsza reszta, bo
+// porządek later_in_search porównuje zestawy od pierwszego biletu.
+// Czas działania to O(MAX_TICKETS * MAX_DURATION * liczba biletów).
+void rebuild_solutions() {
+    STATS_TIMER(REBUILD_SOLUTIONS);
+    STATS_ADD(solver_iterations, (unsigned long long) MAX_TICKETS * (MAX_DURATION + 1) * ticket_frontier.size());
+    // Na początku zestawy co najwyżej 0 biletów - pokrywają tylko czas 0.
+    auto shorter = std::make_shared<solution_table>(MAX_DURATION + 1, NO_COMBINATION);
+    (*shorter)[0] = EMPTY_COMBINATION;
+
+    for (int count = 1; count <= MAX_TICKETS; count++) {
+        auto solution = std::make_shared<solution_table>(MAX_DURATION + 1, NO_COMBINATION);
+        // Zapytanie zawsze dotyczy dodatniego czasu, więc wynik nie może
+        // być pustym zestawem.
+        if (count < MAX_TICKETS) {
+            (*solution)[0] = EMPTY_COMBINATION;
+        }
+        for (int time = 0; time <= MAX_DURATION; time++) {
+            for (int i : ticket_frontier) {
+                combination candidate = prepend(i, lookup(*shorter, time - capped_duration(i)));
+                if (better(candidate, (*solution)[time])) {
+                    (*solution)[time] = candidate;
+                }
             }
         }
+        shorter = solution;
     }
-    create_output(st, nd, rd);
+    best_solution = shorter;
 }
 
-void find_best_combination(const int duration) {
-    create_solution(duration);
+void create_output(const combination &solution) {
+    if (solution.id[0] == -1) {
+        write_output(":-|\n");
+        return;
+    }
+    write_output("! ");
+    for (int i = 0; i < MAX_TICKETS && solution.id[i] != -1; i++) {
+        if (i > 0) {
+            write_output("; ");
+        }
+        write_output(name_of_ticket(solution.id[i]));
+        sold_tickets += 1;
+    }
+    write_output("\n");
+}
+
+void create_solution(const int duration, const solution_table &solution) {
+    combination best = lookup(solution, duration);
+    // Pierwotne rozwiązanie odrzucało zestawy droższe niż MAX_INT.
+    if (best.cost > (unsigned) MAX_INT) {
+        best = NO_COMBINATION;
+    }
+    create_output(best);
 }
 
-// Rozpatruje linię z komendą dodania kursu, w razie błądu w komendzie
+void find_best_combination(const int duration, const solution_table &solution) {
+    create_solution(duration, solution);
+}
+
+// Stan widoczny dla zapytania - liczba kursów dodanych przed zapytaniem
+// oraz tablica najtańszych zestawów biletów z chwili zapytania.
+struct snapshot {
+    unsigned courses;
+    std::shared_ptr<const solution_table> solution;
+};
+
+snapshot current_snapshot() {
+    return {number_of_courses, best_solution};
+}
+
+// Rozpatruje wczytaną komendę dodania kursu, w razie błędu w komendzie
 // wywołuje funkcję call_error, jeśli komenda jest poprawna dodaje rozkład
 // kursu do wektora i mapuje jego numer.
-void execute_course_adding(std::string &line, int line_number) {
-    std::regex course_number_regex("^([0-9]+)");
-    std::regex time_regex("((?:2[0-3]|1[0-9]|[1-9]):[0-5][0-9])");
-    std::regex stop_name_regex("([a-zA-Z_^]+)");
-    std::string course_number, time_arriving, stop_name;
-    std::string line_backup = line;
-
-    course_number = first_match(line, course_number_regex);
-    unsigned course = string_to_ull(course_number);
-
-    if (line_id.count(course)) {
-        call_error(line_number, line_backup);
+void execute_course_adding(const course_line &course, const std::string_view line, int line_number) {
+    STATS_TIMER(COURSE_ADDING);
+    if (line_id.count(course.number)) {
+        call_error(line_number, line, DUPLICATE_COURSE);
         return;
     }
 
-    // Mapowanie numeru kursu
-    line_id[course] = number_of_courses;
-
-    std::unordered_map<std::string, unsigned> course_timetable;
-    // Set do wychwycenia powtórzeń w trasie kursu
-    std::unordered_set<std::string> visited_stops;
     unsigned time_limit_bottom = string_to_time("5:55") - 1;
-    unsigned minutes;
 
-    // Kolejne czasy oraz przystanki są ucinane z początku komendy aż do jej
-    // zakończenia. W przypadku powtórzenia nazwy przystanku lub wczytania
-    // niepoprawnego czasu (przed poprzednim przystankiem/rozpoczęciem pracy
-    // lub po zakończeniu pracy), wywołuję call_error i cofam mapowanie
-    // numeru kursu.
-    while (!line.empty()) {
-        time_arriving = first_match(line, time_regex);
-        minutes = string_to_time(time_arriving);
-
-        if (!valid_minutes(time_limit_bottom, minutes)) {
-            line_id.erase(course);
-            call_error(line_number, line_backup);
+    // W przypadku niepoprawnego czasu (przed poprzednim przystankiem/
+    // rozpoczęciem pracy lub po zakończeniu pracy), wywołuję call_error.
+    for (auto &stop : course.stops) {
+        if (!valid_minutes(time_limit_bottom, stop.first)) {
+            call_error(line_number, line, INVALID_TIME);
             return;
         }
+        time_limit_bottom = stop.first;
+    }
 
-        time_limit_bottom = minutes;
-
-        stop_name = first_match(line, stop_name_regex);
-        if (visited_stops.count(stop_name)) {
-            line_id.erase(course);
-            call_error(line_number, line_backup);
-            return;
-        }
+    // Powtórzenia przystanku sprawdzam na nazwach, zanim nadam przystankom
+    // identyfikatory - odrzucony kurs nie może dodać żadnego przystanku.
+    // Po posortowaniu powtórzenia sąsiadują ze sobą.
+    std::vector<std::string_view> names;
+    names.reserve(course.stops.size());
+    for (auto &stop : course.stops) {
+        names.push_back(stop.second);
+    }
+    std::sort(names.begin(), names.end());
+    if (std::adjacent_find(names.begin(), names.end()) != names.end()) {
+        call_error(line_number, line, REPEATED_STOP);
+        return;
+    }
 
-        visited_stops.insert(stop_name);
-        course_timetable[stop_name] = minutes;
+    std::vector<std::pair<unsigned, unsigned>> course_timetable;
+    course_timetable.reserve(course.stops.size());
+    for (auto &[minutes, stop_name] : course.stops) {
+        course_timetable.emplace_back(intern_stop(stop_name), minutes);
     }
+    std::sort(course_timetable.begin(), course_timetable.end());
     // Jeśli nie przerwano działania funkcji, to znaczy, że zapytanie jest
-    // poprawne, dodaję rozkład do wektora kursów i zwiększam licznik
-    // przechowywanych kursów.
+    // poprawne, mapuję numer kursu, dopisuję rozkład do tablicy kursów
+    // i zwiększam licznik przechowywanych kursów.
+    line_id[course.number] = number_of_courses;
+    course_numbers.push_back(course.number);
+    for (unsigned i = 0; i < course.stops.size(); i++) {
+        departures.push_back({find_stop(course.stops[i].second), course.stops[i].first, number_of_courses, i});
+        if (i + 1 < course.stops.size()) {
+            connections.push_back({course.stops[i].first, course.stops[i + 1].first,
+                                   find_stop(course.stops[i].second), find_stop(course.stops[i + 1].second),
+                                   number_of_courses});
+        }
+    }
     number_of_courses++;
-    timetable.push_back(course_timetable);
+    course_stops.insert(course_stops.end(), course_timetable.begin(), course_timetable.end());
+    course_begin.push_back(course_stops.size());
 }
 
-// Rozpatruje linię z komendą dodania biletu, wywołuje funkcję
-// call_error jeśli któryś z paremetrów jest niepoprawny, jeśli są poprawne,
+// Rozpatruje wczytaną komendę dodania biletu, wywołuje funkcję
+// call_error jeśli bilet o tej nazwie już istnieje, w przeciwnym przypadku
 // dodaje bilet do wektora biletów
-void execute_ticket_adding(std::string &line, int line_number) {
-    std::regex ticket_name_regex("((?:[a-zA-Z ])+)");
-    std::regex ticket_price_regex("((?:[0-9])+\\.[0-9]{2})");
-    std::regex ticket_valid_regex("([1-9][0-9]*)");
-    std::string ticket_name, ticket_price, ticket_valid;
-    std::string line_backup = line;
-
-    ticket_name = first_match(line, ticket_name_regex);
-    ticket_name.erase(ticket_name.size() - 1, ticket_name.size());
-    ticket_price = first_match(line, ticket_price_regex);
-    ticket_valid = first_match(line, ticket_valid_regex);
-
-    int price_int = string_to_ull(ticket_price);
-    int valid_time = string_to_ull(ticket_valid);
+void execute_ticket_adding(const ticket_line &ticket, const std::string_view line, int line_number) {
+    STATS_TIMER(TICKET_ADDING);
+    std::string ticket_name(ticket.name);
 
     if (check_if_exists(ticket_name)) {
-        call_error(line_number, line_backup);
+        call_error(line_number, line, DUPLICATE_TICKET);
         return;
     }
     // Jeśli nie przerwano działania funkcji, to znaczy, że parametry są
     // poprawne, dodaje bilet do wektora biletów.
-    add_ticket(ticket_name, valid_time, price_int);
+    add_ticket(ticket_name, ticket.duration, ticket.price);
+    update_frontier(tickets.size() - 1);
+    // Tablicę trzeba przeliczyć nawet dla zdominowanego biletu, bo remisy
+    // rozstrzyga się względem indeksu ostatniego biletu.
+    rebuild_solutions();
 }
 
-// Rozpatruje linię z komendą zapytania o trasę, wywołuje funkcję
+// Rozpatruje wczytaną komendę zapytania o trasę, wywołuje funkcję
 // call_error jeśli któryś z paremetrów jest niepoprawny,
 // lub jeśli nie da się przebyć tej trasy dodanymi kursami.
 // Odpowiada na pytanie jakimi biletami najtaniej można przejechać zadaną trasę,
 // wypisuje ":-( nazwa_przystanku", jeśli nie da się przebyć tej trasy bez
 // czekania lub wypisuje ":-|" jeśli dodane bilety nie wystarzczą na
-// przejechanie trasy
-void execute_course_query(std::string &line, int line_number) {
-    std::regex stop_name_regex("([a-zA-Z_^]+)");
-    std::regex course_number_regex("([0-9]+)");
-    std::string start, stop, course_number;
-    std::string line_backup = line;
-
-    start = first_match(line, stop_name_regex);
-
-    course_number = first_match(line, course_number_regex);
-    stop = first_match(line, stop_name_regex);
-    unsigned course_number_int = string_to_ull(course_number);
-    unsigned start_time, last_time;
-
-    // Pierwsze 2 przystanki są sprawdzane osobno - sprawdzam czy linia istnieje,
-    // czy podane przystanki należą do linii oraz czy następują po sobie w
-    // dobrej kolejności.
-    if(!line_id.count(course_number_int)) {
-      call_error(line_number, line_backup);
-      return;
-    }
-    if (timetable[line_id[course_number_int]].count(start)) {
-        start_time = timetable[line_id[course_number_int]][start];
-        if (timetable[line_id[course_number_int]].count(stop) &&
-          start_time < timetable[line_id[course_number_int]][stop]) {
-            last_time = timetable[line_id[course_number_int]][stop];
-        } else {
-            call_error(line_number, line_backup);
-            return;
-        }
-    } else {
-        call_error(line_number, line_backup);
-        return;
-    }
-
-    start = stop;
+// przejechanie trasy. Bierze pod uwagę jedynie kursy i bilety ze stanu state.
+void execute_course_query(const query_line &query, const std::string_view line, int line_number,
+                          const snapshot &state) {
+    STATS_TIMER(COURSE_QUERY);
+    unsigned start = find_stop(query.start), stop;
+    unsigned start_time = 0, last_time = 0;
 
     // Każdy kolejny przystanek jest "doklejany" do poprzednich:
-    // Sprawdzam czy podana linia istnieje, czy przystanek istnieje dla podanej
+    // Sprawdzam czy podana linia istnieje, czy oba przystanki należą do
     // linii, czy czas dojadu na przystanek nie jest mniejszy bądź równy
     // czasowi z ostatniego przystanku oraz czy jest równy czasowi dojazdu
-    // poprzedniej linii na ten przystanek.
-    while (!line.empty()) {
-        course_number = first_match(line, course_number_regex);
-        course_number_int = string_to_ull(course_number);
-
-        stop = first_match(line, stop_name_regex);
-
-        if(!line_id.count(course_number_int)) {
-          call_error(line_number, line_backup);
-          return;
-        }
-        if (timetable[line_id[course_number_int]].count(start) &&
-            timetable[line_id[course_number_int]].count(stop)) {
-            unsigned on_start = timetable[line_id[course_number_int]][start];
-            unsigned on_stop = timetable[line_id[course_number_int]][stop];
-            if (last_time == on_start && on_start < on_stop) {
-                last_time = on_stop;
-                start = stop;
-            } else {
-                if (last_time >= on_start) {
-                    call_error(line_number, line_backup);
-                    return;
-                }
-                std::cout << ":-( " << start << "\n";
+    // poprzedniej linii na ten przystanek. Pierwszy odcinek wyznacza
+    // jedynie czas rozpoczęcia podróży.
+    for (size_t i = 0; i < query.legs.size(); i++) {
+        auto &[course_number, stop_name] = query.legs[i];
+        stop = find_stop(stop_name);
+
+        auto course = line_id.find(course_number);
+        if (course == line_id.end() || (unsigned) course->second >= state.courses) {
+            call_error(line_number, line, UNKNOWN_COURSE);
+            return;
+        }
+        unsigned on_start = arrival_time(course->second, start);
+        unsigned on_stop = arrival_time(course->second, stop);
+        if (on_start == NO_TIME || on_stop == NO_TIME) {
+            call_error(line_number, line, STOP_NOT_ON_COURSE);
+            return;
+        }
+        if (i == 0) {
+            if (on_start >= on_stop) {
+                call_error(line_number, line, WRONG_ORDER);
                 return;
             }
-        } else {
-            call_error(line_number, line_backup);
+            start_time = on_start;
+        } else if (last_time != on_start || on_start >= on_stop) {
+            if (last_time >= on_start) {
+                call_error(line_number, line, WRONG_ORDER);
+                return;
+            }
+            write_output(":-( ");
+            write_output(stop_names[start]);
+            write_output("\n");
             return;
         }
+        last_time = on_stop;
+        start = stop;
     }
     // Jeśli nie przerwano działania funkcji, to znaczy, że zapytanie jest
     // poprawne i należy wyliczyć wynik dla policzonego czasu jazdy.
-    find_best_combination(last_time - start_time + 1);
+    find_best_combination(last_time - start_time + 1, *state.solution);
 }
 
-// Wyszukuje we wczytanej linii którejś z dostępnych komend, jeśli odnajdzie
-// dopasowanie, przekzuje linię odpowiedniej funkcji wywołującej.
-// Jeśli linia nie pasuje do żadnego wzorca, wywołuje funkcję call_error.
-// Ignoruje puste linie.
-void execute_line(int line_number, std::string &line) {
-    std::regex course_regex("^([0-9]+)((?: (?:(?:2[0-3]|1[0-9]|[1-9]):[0-5][0-9]) (?:[a-zA-Z_^]+)){2,})$");
-    std::regex ticket_regex("^((?:[a-zA-Z ])+) ((?:[0-9])+\\.[0-9]{2}) ([1-9][0-9]*)$");
-    std::regex query_regex("^\\? (?:[a-zA-Z_^]+)( (?:[0-9]+) (?:[a-zA-Z_^]+))+$");
+/* Planowanie podróży */
 
-    if (line.empty()) {
+// Pierwsza minuta pracy tramwajów. Godziny wszystkich kursów mieszczą się
+// w MAX_DURATION minutach od niej.
+const unsigned FIRST_MINUTE = time_to_minutes(5, 55);
+
+// Połączenie, którym dotarliśmy na przystanek początkowy
+const unsigned FROM_ORIGIN = -1;
+
+// Pobyt na przystanku osiągnięty w zapytaniu o numerze epoch - połączenie,
+// którym tam dotarliśmy.
+struct reached_event {
+    unsigned epoch;
+    unsigned connection;
+};
+
+// Stan planowania podróży używany ponownie przez kolejne zapytania:
+// pobyty na przystankach w tablicy indeksowanej przystankiem i minutą oraz
+// kursy, do których wsiedliśmy. Wpisy z numerem innym niż numer bieżącego
+// zapytania są nieaktualne, więc tablic nie trzeba czyścić.
+struct journey_search {
+    std::vector<reached_event> reached;
+    std::vector<unsigned> boarded;
+    unsigned epoch = 0;
+};
+
+// Stany planowania współdzielone przez wątki. W trybie serwera zapytania są
+// rozpatrywane równolegle przez dowolnie wielu klientów, a stan zajmuje
+// stops * MAX_DURATION wpisów, więc stanów jest co najwyżej tyle, ile
+// rdzeni - gdy wszystkie są zajęte, zapytanie czeka na zwolnienie któregoś.
+// Deque nie przenosi istniejących stanów przy dodawaniu nowych.
+std::mutex searches_mutex;
+std::condition_variable search_released;
+std::deque<journey_search> searches;
+std::vector<journey_search *> free_searches;
+
+// Stan planowania zajęty na czas jednego zapytania i zwalniany w destruktorze
+class search_lease {
+public:
+    search_lease() {
+        std::unique_lock<std::mutex> lock(searches_mutex);
+        size_t limit = std::max(1u, std::thread::hardware_concurrency());
+        search_released.wait(lock, [limit]() {
+            return !free_searches.empty() || searches.size() < limit;
+        });
+        if (free_searches.empty()) {
+            searches.emplace_back();
+            search = &searches.back();
+        } else {
+            search = free_searches.back();
+            free_searches.pop_back();
+        }
+    }
+
+    ~search_lease() {
+        {
+            std::lock_guard<std::mutex> lock(searches_mutex);
+            free_searches.push_back(search);
+        }
+        search_released.notify_one();
+    }
+
+    search_lease(const search_lease &) = delete;
+    search_lease &operator=(const search_lease &) = delete;
+
+    journey_search &get() const {
+        return *search;
+    }
+
+private:
+    journey_search *search;
+};
+
+// Rozpoczyna nowe zapytanie w zajętym stanie search - dopasowuje tablice do
+// bieżącej liczby przystanków i kursów i nadaje zapytaniu nowy numer.
+journey_search &start_journey_search(journey_search &search) {
+    search.reached.resize(stop_names.size() * MAX_DURATION);
+    search.boarded.resize(number_of_courses);
+    if (++search.epoch == 0) {
+        std::fill(search.reached.begin(), search.reached.end(), reached_event{0, 0});
+        std::fill(search.boarded.begin(), search.boarded.end(), 0);
+        search.epoch = 1;
+    }
+    return search;
+}
+
+// Indeks pobytu na przystanku stop o godzinie minute w journey_search::reached
+size_t event_index(const unsigned stop, const unsigned minute) {
+    return (size_t) stop * MAX_DURATION + (minute - FIRST_MINUTE);
+}
+
+// Wypisuje trasę złożoną z połączeń path w postaci zapytania o trasę.
+void write_itinerary(const std::vector<size_t> &path) {
+    write_output("?");
+    for (size_t i = 0; i < path.size(); i++) {
+        const connection &current = connections[path[i]];
+        if (i == 0) {
+            write_output(" ");
+            write_output(stop_names[current.from]);
+        }
+        if (i + 1 == path.size() || connections[path[i + 1]].course != current.course) {
+            write_output(" ");
+            write_output(std::to_string(course_numbers[current.course]));
+            write_output(" ");
+            write_output(stop_names[current.to]);
+        }
+    }
+    write_output("\n");
+}
+
+// Rozpatruje wczytane zapytanie o podróż, wywołuje funkcję call_error, jeśli
+// któryś z przystanków nie istnieje lub oba są tym samym przystankiem.
+// Wyszukuje trasę bez czekania, która zaczyna się na przystanku początkowym
+// dokładnie o podanej godzinie i najwcześniej dociera do celu. Wypisuje ją
+// w postaci zapytania o trasę, a następnie odpowiada na nie jak
+// execute_course_query. Jeśli takiej trasy nie ma, wypisuje
+// ":-( przystanek_początkowy".
+// Trasa jest wyznaczana algorytmem Connection Scan - połączenia są
+// przeglądane liniowo w kolejności odjazdu, a połączenie jest osiągalne,
+// jeśli jedziemy już jego kursem albo jesteśmy na przystanku odjazdu
+// dokładnie o godzinie odjazdu.
+void execute_journey_planning(const plan_line &plan, const std::string_view line, int line_number) {
+    STATS_TIMER(JOURNEY_PLANNING);
+    unsigned origin = find_stop(plan.start);
+    unsigned destination = find_stop(plan.destination);
+    if (origin == NO_STOP || destination == NO_STOP || origin == destination) {
+        call_error(line_number, line, INVALID_JOURNEY);
+        return;
+    }
+    sort_timetable();
+    // Trasa bez czekania zaczyna się kursem odjeżdżającym z przystanku
+    // początkowego dokładnie o podanej godzinie - jeśli takiego nie ma,
+    // indeks zatrzymań rozstrzyga to bez przeglądania połączeń.
+    if (!departs_at(origin, plan.minutes)) {
+        write_output(":-( ");
+        write_output(stop_names[origin]);
+        write_output("\n");
+        return;
+    }
+
+    search_lease lease;
+    journey_search &search = start_journey_search(lease.get());
+    unsigned epoch = search.epoch;
+    // Poza godzinami pracy tramwajów nie odjeżdża żadne połączenie.
+    if (FIRST_MINUTE <= plan.minutes && plan.minutes < FIRST_MINUTE + MAX_DURATION) {
+        search.reached[event_index(origin, plan.minutes)] = {epoch, FROM_ORIGIN};
+    }
+    unsigned arrival = NO_TIME;
+    size_t last = NO_CONNECTION;
+
+    auto first = std::lower_bound(connections.begin(), connections.end(),
+                                  connection{plan.minutes, 0, 0, 0, 0});
+    size_t i = first - connections.begin();
+    for (; i < connections.size() && connections[i].departure_minute < arrival; i++) {
+        const connection &current = connections[i];
+        if (search.boarded[current.course] != epoch
+            && search.reached[event_index(current.from, current.departure_minute)].epoch != epoch) {
+            continue;
+        }
+        search.boarded[current.course] = epoch;
+        reached_event &event = search.reached[event_index(current.to, current.arrival_minute)];
+        if (event.epoch != epoch) {
+            event = {epoch, (unsigned) i};
+        }
+        if (current.to == destination && current.arrival_minute < arrival) {
+            arrival = current.arrival_minute;
+            last = i;
+        }
+    }
+
+    STATS_ADD(scanned_connections, i - (first - connections.begin()));
+
+    if (last == NO_CONNECTION) {
+        write_output(":-( ");
+        write_output(stop_names[origin]);
+        write_output("\n");
         return;
-    } else if (std::regex_match(line, course_regex)) {
-        execute_course_adding(line, line_number);
-    } else if (std::regex_match(line, ticket_regex)) {
-        execute_ticket_adding(line, line_number);
-    } else if (std::regex_match(line, query_regex)) {
-        execute_course_query(line, line_number);
+    }
+    std::vector<size_t> path;
+    for (unsigned i = last; i != FROM_ORIGIN;
+         i = search.reached[event_index(connections[i].from, connections[i].departure_minute)].connection) {
+        path.push_back(i);
+    }
+    std::reverse(path.begin(), path.end());
+    write_itinerary(path);
+    find_best_combination(arrival - plan.minutes + 1, *best_solution);
+}
+
+// Rozpoznaje we wczytanej linii którąś z dostępnych komend - rodzaj komendy
+// wyznacza pierwszy znak linii. Jeśli linia jest poprawna, przekazuje
+// wczytaną komendę odpowiedniej funkcji wywołującej, w przeciwnym
+// przypadku wywołuje funkcję call_error. Ignoruje puste linie.
+void execute_line(int line_number, const std::string_view line) {
+    static thread_local course_line course;
+    static thread_local ticket_line ticket;
+    static thread_local query_line query;
+    static thread_local plan_line plan;
+    STATS_TIMER(EXECUTE_LINE);
+
+    if (line.empty()) {
+        STATS_ADD(lines[EMPTY_LINE], 1);
+    } else if (is_digit(line[0]) && parse_course(line, course)) {
+        STATS_ADD(lines[COURSE_LINE], 1);
+        execute_course_adding(course, line, line_number);
+    } else if (is_ticket_name_char(line[0]) && parse_ticket(line, ticket)) {
+        STATS_ADD(lines[TICKET_LINE], 1);
+        execute_ticket_adding(ticket, line, line_number);
+    } else if (line[0] == '?' && parse_query(line, query)) {
+        STATS_ADD(lines[QUERY_LINE], 1);
+        execute_course_query(query, line, line_number, current_snapshot());
+    } else if (line[0] == '?' && parse_plan(line, plan)) {
+        STATS_ADD(lines[PLAN_LINE], 1);
+        execute_journey_planning(plan, line, line_number);
     } else {
-        call_error(line_number, line);
+        STATS_ADD(lines[INVALID_LINE], 1);
+        call_error(line_number, line, SYNTAX_ERROR);
+    }
+
+#ifdef KASA_STATS
+    if (stats_requested) {
+        stats_requested = 0;
+        report_statistics();
+    }
+#endif
+}
+
+/* Tryb wielowątkowy */
+
+// Liczba wątków rozpatrujących zapytania, 0 oznacza rozpatrywanie
+// wszystkich linii na bieżąco w wątku głównym.
+unsigned worker_threads = 0;
+
+// Liczba linii, po której wczytaniu oczekujące zapytania są rozpatrywane
+const size_t CHUNK_LINES = 1 << 16;
+
+// Odpowiedzi i komunikaty o błędach wygenerowane przez jedną linię
+struct line_result {
+    std::string output;
+    std::string errors;
+};
+
+// Zapytanie oczekujące na rozpatrzenie wraz ze stanem z chwili wczytania
+// i indeksem wyniku, w którym należy zapisać odpowiedź.
+struct pending_query {
+    size_t result;
+    int line_number;
+    std::string_view line;
+    query_line query;
+    snapshot state;
+};
+
+std::vector<line_result> pending_results;
+std::vector<pending_query> pending_queries;
+
+// Przenosi zawartość buforów bieżącego wątku do wyniku linii.
+void move_buffers(line_result &result) {
+    result.output.swap(output_buffer);
+    result.errors.swap(error_buffer);
+    output_buffer.clear();
+    error_buffer.clear();
+}
+
+// Pula wątków pomocniczych rozpatrujących zapytania razem z wątkiem
+// głównym. Wątki są uruchamiane raz i między partiami zapytań czekają na
+// zmianę numeru partii, zamiast być tworzone od nowa dla każdego bloku
+// wejścia. Mutex chroni numer partii, licznik zajętych wątków i flagę
+// zakończenia.
+struct query_pool {
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable work_done;
+    std::vector<std::thread> threads;
+    unsigned long long batch = 0;
+    unsigned busy = 0;
+    bool stopping = false;
+    std::atomic<size_t> next_query{0};
+
+    ~query_pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        work_ready.notify_all();
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    }
+};
+
+// Rozpatruje kolejne nierozpatrzone zapytania z bieżącej partii.
+void execute_pending_queries(query_pool &pool) {
+    size_t i;
+    while ((i = pool.next_query++) < pending_queries.size()) {
+        pending_query &pending = pending_queries[i];
+        execute_course_query(pending.query, pending.line, pending.line_number, pending.state);
+        move_buffers(pending_results[pending.result]);
+    }
+}
+
+// Pętla wątku pomocniczego - czeka na nową partię, rozpatruje jej zapytania
+// i zgłasza zakończenie.
+void pool_worker(query_pool &pool) {
+    unsigned long long done = 0;
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    while (true) {
+        pool.work_ready.wait(lock, [&pool, done]() {
+            return pool.stopping || pool.batch != done;
+        });
+        if (pool.stopping) {
+            return;
+        }
+        done = pool.batch;
+        lock.unlock();
+        execute_pending_queries(pool);
+        lock.lock();
+        if (--pool.busy == 0) {
+            pool.work_done.notify_one();
+        }
+    }
+}
+
+// Zwraca pulę, przy pierwszym wywołaniu uruchamiając worker_threads - 1
+// wątków pomocniczych.
+query_pool &get_query_pool() {
+    static query_pool pool;
+    if (pool.threads.empty()) {
+        for (unsigned i = 1; i < worker_threads; i++) {
+            pool.threads.emplace_back(pool_worker, std::ref(pool));
+        }
+    }
+    return pool;
+}
+
+// Rozpatruje oczekujące zapytania na worker_threads wątkach, po czym
+// wypisuje wyniki wszystkich oczekujących linii w kolejności wczytania.
+// Bufory wątku głównego pozostają puste, bo move_buffers przenosi z nich
+// wyniki kolejnych linii.
+// Zapytania korzystają tylko z zapamiętanych stanów oraz z danych, które
+// są jedynie dopisywane, a w trakcie ich rozpatrywania nic nie jest
+// modyfikowane. Partię i jej wyniki przekazuje mutex puli.
+void run_pending() {
+    if (!pending_queries.empty()) {
+        query_pool &pool = get_query_pool();
+        pool.next_query = 0;
+        {
+            std::lock_guard<std::mutex> lock(pool.mutex);
+            pool.busy = pool.threads.size();
+            ++pool.batch;
+        }
+        pool.work_ready.notify_all();
+        execute_pending_queries(pool);
+        std::unique_lock<std::mutex> lock(pool.mutex);
+        pool.work_done.wait(lock, [&pool]() {
+            return pool.busy == 0;
+        });
+    }
+
+    for (auto &result : pending_results) {
+        std::cerr.write(result.errors.data(), result.errors.size());
+        std::cout.write(result.output.data(), result.output.size());
+    }
+    pending_results.clear();
+    pending_queries.clear();
+}
+
+// Odkłada zapytanie do rozpatrzenia przez run_pending, pozostałe linie
+// rozpatruje od razu, zapamiętując ich wyniki.
+void schedule_line(int line_number, const std::string_view line) {
+    static query_line query;
+
+    if (line.empty()) {
+        STATS_ADD(lines[EMPTY_LINE], 1);
         return;
     }
+    pending_results.emplace_back();
+    if (line[0] == '?' && parse_query(line, query)) {
+        STATS_ADD(lines[QUERY_LINE], 1);
+        pending_queries.push_back({pending_results.size() - 1, line_number, line, query, current_snapshot()});
+    } else {
+        execute_line(line_number, line);
+        move_buffers(pending_results.back());
+    }
+    if (pending_results.size() >= CHUNK_LINES) {
+        run_pending();
+    }
+}
 
+// Rozpatruje linię od razu albo, w trybie wielowątkowym, odkłada ją.
+void process_line(int line_number, const std::string_view line) {
+    if (worker_threads == 0) {
+        execute_line(line_number, line);
+    } else {
+        schedule_line(line_number, line);
+    }
 }
 
-// Funkcja sterująca programem.
-// Wczytuje linie do napotkania końca pliku i przekazuje ich rozpatrzenie
-// funkcji execute_line. Na koniec działania programu
-// wypisuje liczbę kupionych biletów
-int main() {
-    std::string line;
+/* Tryb wsadowy */
+
+// Rozmiar bloku, którym wczytywane jest standardowe wejście
+const size_t BLOCK_SIZE = 1 << 20;
+
+// Rozpatruje wszystkie pełne linie z tekstu, zaczynając od linii o numerze
+// line_number. Zwraca liczbę znaków niezakończonej ostatniej linii.
+// Linie są widokami na tekst, więc przed powrotem trzeba rozpatrzyć
+// również odłożone zapytania.
+size_t execute_lines(const std::string_view text, int &line_number) {
+    size_t begin = 0, end;
+    while ((end = text.find('\n', begin)) != std::string_view::npos) {
+        process_line(line_number++, text.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    if (worker_threads != 0) {
+        run_pending();
+    }
+    return text.size() - begin;
+}
+
+// Rozpatruje ostatnią linię, która nie musi kończyć się znakiem nowej linii.
+void execute_last_line(const std::string_view text, int line_number) {
+    process_line(line_number, text);
+    if (worker_threads != 0) {
+        run_pending();
+    }
+}
+
+// Wczytuje standardowe wejście blokami i rozpatruje kolejne linie bez
+// kopiowania ich do osobnych napisów.
+void execute_stdin() {
+    std::vector<char> buffer(BLOCK_SIZE);
+    size_t filled = 0;
+    int line_number = 1;
+
+    while (true) {
+        if (filled == buffer.size()) {
+            buffer.resize(2 * buffer.size());
+        }
+        size_t read = fread(buffer.data() + filled, 1, buffer.size() - filled, stdin);
+        if (read == 0) {
+            break;
+        }
+        filled += read;
+        size_t rest = execute_lines(std::string_view(buffer.data(), filled), line_number);
+        std::copy(buffer.begin() + (filled - rest), buffer.begin() + filled, buffer.begin());
+        filled = rest;
+    }
+    execute_last_line(std::string_view(buffer.data(), filled), line_number);
+}
+
+// Mapuje plik do pamięci tylko do odczytu i zapisuje jego rozmiar w size.
+// Zwraca nullptr, jeśli pliku nie udało się otworzyć. Pusty plik nie jest
+// mapowany - zwracany jest wtedy wskaźnik na pusty napis.
+const char *map_file(const char *path, size_t &size) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return nullptr;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == -1) {
+        close(fd);
+        return nullptr;
+    }
+    size = file_stat.st_size;
+    if (size == 0) {
+        close(fd);
+        return "";
+    }
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+    return static_cast<const char *>(data);
+}
+
+void unmap_file(const char *data, const size_t size) {
+    if (size > 0) {
+        munmap(const_cast<char *>(data), size);
+    }
+}
+
+// Mapuje plik do pamięci i rozpatruje kolejne linie bez ich kopiowania.
+// Zwraca false, jeśli pliku nie udało się otworzyć.
+bool execute_file(const char *path) {
+    size_t size;
+    const char *data = map_file(path, size);
+    if (data == nullptr) {
+        return false;
+    }
+    int line_number = 1;
+    std::string_view text(data, size);
+    size_t rest = execute_lines(text, line_number);
+    execute_last_line(text.substr(size - rest), line_number);
+    unmap_file(data, size);
+    return true;
+}
+
+/* Zapis i odczyt stanu */
+
+// Plik ze stanem kasy ma postać (wszystkie liczby to 32-bitowe liczby bez
+// znaku w kolejności bajtów komputera, który zapisał plik):
+//   nagłówek: SNAPSHOT_MAGIC, SNAPSHOT_VERSION, liczba kursów, liczba
+//     zatrzymań, liczba przystanków, długość nazw przystanków, liczba
+//     biletów, długość nazw biletów,
+//   numery kursów, tablica course_begin, pary z tablicy course_stops,
+//   początki nazw przystanków (o jeden więcej niż przystanków),
+//   ceny biletów, czasy ważności biletów, początki nazw biletów,
+//   sklejone nazwy przystanków, sklejone nazwy biletów.
+// Tablice liczb leżą przed napisami, więc po zmapowaniu pliku są wyrównane
+// i można je skopiować bez żadnego przetwarzania. Indeksy pomocnicze
+// (identyfikatory przystanków, połączenia, tablica zestawów biletów)
+// są odtwarzane przy wczytywaniu.
+const uint32_t SNAPSHOT_MAGIC = 0x5341534b;
+const uint32_t SNAPSHOT_VERSION = 1;
+const size_t SNAPSHOT_HEADER = 8;
+
+void write_words(FILE *file, const uint32_t *words, const size_t count) {
+    fwrite(words, sizeof(uint32_t), count, file);
+}
+
+// Zapisuje stan kasy (kursy, przystanki i bilety) do pliku path.
+// Zwraca false w przypadku błędu zapisu.
+bool save_snapshot(const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    std::vector<uint32_t> stop_offsets = {0}, ticket_offsets = {0};
+    std::vector<uint32_t> prices, durations;
+    for (auto &name : stop_names) {
+        stop_offsets.push_back(stop_offsets.back() + name.size());
+    }
+    for (uint i = 0; i < tickets.size(); i++) {
+        ticket_offsets.push_back(ticket_offsets.back() + name_of_ticket(i).size());
+        prices.push_back(price_of_ticket(i));
+        durations.push_back(duration_of_ticket(i));
+    }
+    uint32_t header[SNAPSHOT_HEADER] = {SNAPSHOT_MAGIC, SNAPSHOT_VERSION, number_of_courses,
+                                        (uint32_t) course_stops.size(), (uint32_t) stop_names.size(),
+                                        stop_offsets.back(), (uint32_t) tickets.size(), ticket_offsets.back()};
+    write_words(file, header, SNAPSHOT_HEADER);
+    write_words(file, course_numbers.data(), course_numbers.size());
+    write_words(file, course_begin.data(), course_begin.size());
+    for (auto &entry : course_stops) {
+        uint32_t pair[2] = {entry.first, entry.second};
+        write_words(file, pair, 2);
+    }
+    write_words(file, stop_offsets.data(), stop_offsets.size());
+    write_words(file, prices.data(), prices.size());
+    write_words(file, durations.data(), durations.size());
+    write_words(file, ticket_offsets.data(), ticket_offsets.size());
+    for (auto &name : stop_names) {
+        fwrite(name.data(), 1, name.size(), file);
+    }
+    for (auto &ticket : tickets) {
+        fwrite(ticket.first.data(), 1, ticket.first.size(), file);
+    }
+    bool success = !ferror(file);
+    return fclose(file) == 0 && success;
+}
+
+// Sprawdza, czy count napisów sklejonych w chars o początkach offsets
+// (o jeden więcej niż napisów) to niepuste i różne napisy zajmujące
+// dokładnie bytes bajtów.
+bool valid_names(const char *chars, const uint32_t *offsets, const uint32_t count, const uint32_t bytes) {
+    if (offsets[0] != 0 || offsets[count] != bytes) {
+        return false;
+    }
+    std::unordered_set<std::string_view> names;
+    for (uint32_t i = 0; i < count; i++) {
+        if (offsets[i + 1] <= offsets[i] || offsets[i + 1] > bytes
+            || !names.emplace(chars + offsets[i], offsets[i + 1] - offsets[i]).second) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Sprawdza, czy kursy z pliku stanu są takie, jakie mogła dodać komenda
+// dodania kursu: numery się nie powtarzają, każdy kurs ma co najmniej dwa
+// zatrzymania posortowane po rosnących identyfikatorach przystanków,
+// a godziny przyjazdu mieszczą się w godzinach pracy tramwajów i są różne,
+// czyli rosną wzdłuż trasy.
+bool valid_courses(const uint32_t *numbers, const uint32_t *begins, const uint32_t *stop_entries,
+                   const uint32_t courses, const uint32_t entries, const uint32_t stops) {
+    if (begins[0] != 0 || begins[courses] != entries) {
+        return false;
+    }
+    std::unordered_set<uint32_t> seen;
+    std::vector<unsigned> minutes;
+    for (uint32_t course = 0; course < courses; course++) {
+        if (!seen.insert(numbers[course]).second || begins[course + 1] > entries
+            || begins[course + 1] < (uint64_t) begins[course] + 2) {
+            return false;
+        }
+        minutes.clear();
+        for (uint32_t i = begins[course]; i < begins[course + 1]; i++) {
+            uint32_t stop = stop_entries[2 * i], minute = stop_entries[2 * i + 1];
+            if (stop >= stops || (i > begins[course] && stop <= stop_entries[2 * (i - 1)])
+                || !valid_minutes(time_to_minutes(5, 55) - 1, minute)) {
+                return false;
+            }
+            minutes.push_back(minute);
+        }
+        std::sort(minutes.begin(), minutes.end());
+        if (std::adjacent_find(minutes.begin(), minutes.end()) != minutes.end()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Odtwarza stan kasy z pliku zmapowanego pod adresem data. Stan musi być
+// pusty. Zwraca false, jeśli plik nie jest poprawnym zapisem stanu - cały
+// plik jest sprawdzany, zanim stan zostanie zmieniony.
+bool restore_snapshot(const char *data, const size_t size) {
+    const uint32_t *words = reinterpret_cast<const uint32_t *>(data);
+    if (size < SNAPSHOT_HEADER * sizeof(uint32_t) || words[0] != SNAPSHOT_MAGIC || words[1] != SNAPSHOT_VERSION) {
+        return false;
+    }
+    uint32_t courses = words[2], entries = words[3], stops = words[4], stop_bytes = words[5];
+    uint32_t ticket_count = words[6], ticket_bytes = words[7];
+    size_t word_count = SNAPSHOT_HEADER + courses + ((size_t) courses + 1) + 2 * (size_t) entries
+                        + ((size_t) stops + 1) + 3 * (size_t) ticket_count + 1;
+    if (size != word_count * sizeof(uint32_t) + stop_bytes + ticket_bytes) {
+        return false;
+    }
+    const uint32_t *numbers = words + SNAPSHOT_HEADER;
+    const uint32_t *begins = numbers + courses;
+    const uint32_t *stop_entries = begins + courses + 1;
+    const uint32_t *stop_offsets = stop_entries + 2 * (size_t) entries;
+    const uint32_t *prices = stop_offsets + stops + 1;
+    const uint32_t *durations = prices + ticket_count;
+    const uint32_t *ticket_offsets = durations + ticket_count;
+    const char *stop_chars = reinterpret_cast<const char *>(ticket_offsets + ticket_count + 1);
+    const char *ticket_chars = stop_chars + stop_bytes;
+    if (!valid_courses(numbers, begins, stop_entries, courses, entries, stops)
+        || !valid_names(stop_chars, stop_offsets, stops, stop_bytes)
+        || !valid_names(ticket_chars, ticket_offsets, ticket_count, ticket_bytes)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < ticket_count; i++) {
+        if (durations[i] == 0 || durations[i] > (uint32_t) MAX_INT) {
+            return false;
+        }
+    }
+
+    for (uint32_t i = 0; i < stops; i++) {
+        intern_stop(std::string_view(stop_chars + stop_offsets[i], stop_offsets[i + 1] - stop_offsets[i]));
+    }
+    course_begin.assign(begins, begins + courses + 1);
+    course_stops.resize(entries);
+    for (uint32_t i = 0; i < entries; i++) {
+        course_stops[i] = {stop_entries[2 * i], stop_entries[2 * i + 1]};
+    }
+
+    // Godziny przyjazdu rosną wzdłuż trasy, więc kolejność przystanków na
+    // trasie to kolejność rosnących godzin.
+    std::vector<std::pair<unsigned, unsigned>> route;
+    for (uint32_t course = 0; course < courses; course++) {
+        line_id[numbers[course]] = course;
+        course_numbers.push_back(numbers[course]);
+        route.clear();
+        for (unsigned i = course_begin[course]; i < course_begin[course + 1]; i++) {
+            route.emplace_back(course_stops[i].second, course_stops[i].first);
+        }
+        std::sort(route.begin(), route.end());
+        for (unsigned i = 0; i < route.size(); i++) {
+            departures.push_back({route[i].second, route[i].first, course, i});
+        }
+        for (unsigned i = 0; i + 1 < route.size(); i++) {
+            connections.push_back({route[i].first, route[i + 1].first, route[i].second,
+                                   route[i + 1].second, course});
+        }
+    }
+    number_of_courses = courses;
+
+    for (uint32_t i = 0; i < ticket_count; i++) {
+        add_ticket(std::string(ticket_chars + ticket_offsets[i], ticket_offsets[i + 1] - ticket_offsets[i]),
+                   durations[i], prices[i]);
+        update_frontier(i);
+    }
+    rebuild_solutions();
+    return true;
+}
+
+// Wczytuje stan kasy z pliku path. Zwraca false w przypadku błędu.
+bool load_snapshot(const char *path) {
+    size_t size;
+    const char *data = map_file(path, size);
+    if (data == nullptr) {
+        return false;
+    }
+    bool success = restore_snapshot(data, size);
+    unmap_file(data, size);
+    return success;
+}
+
+/* Tryb serwera */
+
+// Blokada stanu kasy w trybie serwera - zapytania (linie zaczynające się
+// od znaku '?') tylko czytają stan, więc rozpatrują je równolegle czytelnicy,
+// a dodanie kursu lub biletu jest wykonywane na wyłączność.
+std::shared_mutex state_mutex;
+
+// Wysyła cały tekst do klienta. Zwraca false, jeśli klient się rozłączył.
+bool send_all(const int client, const std::string_view text) {
+    size_t sent = 0;
+    while (sent < text.size()) {
+        ssize_t result = send(client, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+        if (result <= 0) {
+            return false;
+        }
+        sent += result;
+    }
+    return true;
+}
+
+// Rozpatruje linię klienta pod odpowiednią blokadą.
+void execute_client_line(const int line_number, const std::string_view line) {
+    if (!line.empty() && line[0] == '?') {
+        std::shared_lock<std::shared_mutex> lock(state_mutex);
+        execute_line(line_number, line);
+    } else {
+        std::unique_lock<std::shared_mutex> lock(state_mutex);
+        execute_line(line_number, line);
+        // Połączenia i zatrzymania są sortowane od razu, aby planowanie
+        // podróży pod blokadą czytelnika niczego nie modyfikowało.
+        sort_timetable();
+    }
+}
+
+// Obsługuje połączenie z klientem. Klient może wysłać wiele linii bez
+// czekania na odpowiedzi - wszystkie pełne linie z wczytanego bloku są
+// rozpatrywane po kolei, a ich odpowiedzi i komunikaty o błędach (numery
+// linii liczone są osobno dla każdego połączenia) są odsyłane razem
+// w kolejności linii.
+void serve_client(const int client) {
+    std::vector<char> buffer(BLOCK_SIZE);
+    size_t filled = 0;
     int line_number = 1;
+    std::string response;
 
-    while (std::getline(std::cin, line)) {
-        execute_line(line_number++, line);
+    while (true) {
+        if (filled == buffer.size()) {
+            buffer.resize(2 * buffer.size());
+        }
+        ssize_t received = recv(client, buffer.data() + filled, buffer.size() - filled, 0);
+        if (received <= 0) {
+            break;
+        }
+        filled += received;
+
+        std::string_view text(buffer.data(), filled);
+        size_t begin = 0, end;
+        while ((end = text.find('\n', begin)) != std::string_view::npos) {
+            execute_client_line(line_number++, text.substr(begin, end - begin));
+            response.append(error_buffer);
+            response.append(output_buffer);
+            error_buffer.clear();
+            output_buffer.clear();
+            begin = end + 1;
+        }
+        std::copy(buffer.begin() + begin, buffer.begin() + filled, buffer.begin());
+        filled -= begin;
+        if (!send_all(client, response)) {
+            break;
+        }
+        response.clear();
     }
+    close(client);
+}
 
-    std::cout << sold_tickets << "\n";
+// Nasłuchuje na gnieździe uniksowym path i obsługuje każdego klienta
+// w osobnym wątku. Zwraca false, jeśli nie udało się utworzyć gniazda.
+bool run_server(const char *path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        return false;
+    }
+    strcpy(address.sun_path, path);
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server == -1) {
+        return false;
+    }
+    unlink(path);
+    if (bind(server, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == -1
+        || listen(server, SOMAXCONN) == -1) {
+        close(server);
+        return false;
+    }
+    sort_timetable();
+
+    while (true) {
+        int client = accept(server, nullptr, nullptr);
+        if (client == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        std::thread(serve_client, client).detach();
+    }
+    close(server);
+    return true;
+}
+
+// Benchmark (kasa_benchmark.cc) dołącza ten plik i definiuje KASA_NO_MAIN,
+// aby wywoływać execute_line bezpośrednio.
+#ifndef KASA_NO_MAIN
+
+// Funkcja sterująca programem.
+// Bez argumentów wczytuje linie do napotkania końca pliku i przekazuje ich
+// rozpatrzenie funkcji execute_line. Z argumentem --bulk lub z podanym
+// plikiem wejściowym wczytuje całe wejście blokami (albo mapuje plik do
+// pamięci), a odpowiedzi wypisuje jednorazowo na końcu. Argument --threads n
+// działa jak --bulk, ale zapytania rozpatruje na n wątkach. Argument
+// --load plik odtwarza przed wczytaniem wejścia stan zapisany wcześniej
+// argumentem --save plik. Argument --serve gniazdo uruchamia serwer
+// przyjmujący komendy przez gniazdo uniksowe zamiast standardowego wejścia.
+// Program skompilowany z flagą KASA_STATS na koniec działania (oraz po
+// otrzymaniu sygnału SIGUSR1) wypisuje statystyki rozpatrywanych linii.
+// Na koniec działania programu wypisuje liczbę kupionych biletów
+int main(int argc, char *argv[]) {
+    bool bulk = false, valid = true;
+    const char *input_path = nullptr, *load_path = nullptr, *save_path = nullptr, *socket_path = nullptr;
+    for (int i = 1; i < argc && valid; i++) {
+        std::string_view arg = argv[i];
+        if (arg == "--bulk") {
+            bulk = true;
+        } else if (arg == "--threads" && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            bulk = true;
+            worker_threads = atoi(argv[++i]);
+        } else if (arg == "--load" && i + 1 < argc) {
+            load_path = argv[++i];
+        } else if (arg == "--save" && i + 1 < argc) {
+            save_path = argv[++i];
+        } else if (arg == "--serve" && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (input_path == nullptr && !arg.empty() && arg[0] != '-') {
+            bulk = true;
+            input_path = argv[i];
+        } else {
+            valid = false;
+        }
+    }
+    if (!valid) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [--bulk | --threads n] [--load snapshot] [--save snapshot] [--serve socket] [file]\n";
+        return 1;
+    }
+#ifdef KASA_STATS
+    signal(SIGUSR1, request_statistics);
+#endif
+    if (load_path != nullptr && !load_snapshot(load_path)) {
+        std::cerr << "Cannot read snapshot " << load_path << "\n";
+        return 1;
+    }
+
+    if (socket_path != nullptr) {
+        if (!run_server(socket_path)) {
+            std::cerr << "Cannot listen on " << socket_path << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    if (!bulk) {
+        std::string line;
+        int line_number = 1;
+
+        while (std::getline(std::cin, line)) {
+            execute_line(line_number++, line);
+            flush_output();
+        }
+    } else {
+        std::ios_base::sync_with_stdio(false);
+        if (input_path == nullptr) {
+            execute_stdin();
+        } else if (!execute_file(input_path)) {
+            std::cerr << "Cannot read file " << input_path << "\n";
+            return 1;
+        }
+    }
+
+    if (save_path != nullptr && !save_snapshot(save_path)) {
+        std::cerr << "Cannot write snapshot " << save_path << "\n";
+        return 1;
+    }
+
+    write_output(std::to_string(sold_tickets.load()));
+    write_output("\n");
+    flush_output();
+#ifdef KASA_STATS
+    report_statistics();
+#endif
 
     return 0;
 }
+
+#endif
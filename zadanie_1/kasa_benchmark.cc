@@ -0,0 +1,247 @@
+/*
+  BENCHMARK KASY BILETOWEJ
+  Generuje syntetyczną sieć tramwajową oraz zapytania w formacie
+  rozpoznawanym przez execute_line, rozpatruje je i wypisuje przepustowość,
+  percentyle czasu rozpatrywania każdego rodzaju linii oraz szczytowe
+  zużycie pamięci.
+
+  Kompilacja: g++ -std=c++17 -O2 -pthread kasa_benchmark.cc -o kasa_benchmark
+  Użycie: ./kasa_benchmark [--stops n] [--courses n] [--tickets n] [--lines n]
+          [--queries n] [--plans n] [--invalid n] [--max-legs n] [--seed n]
+          [--emit]
+  Argumenty --queries, --plans i --invalid to wagi rodzajów linii
+  w części z zapytaniami. Z argumentem --emit wygenerowane wejście jest
+  wypisywane na standardowe wyjście zamiast rozpatrywania.
+*/
+
+#define KASA_NO_MAIN
+#include "kasa.cc"
+
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <sys/resource.h>
+
+namespace {
+
+    // Parametry generowanego wejścia
+    struct workload_config {
+        unsigned stops = 2000;
+        unsigned courses = 20000;
+        unsigned tickets = 200;
+        unsigned lines = 200000;
+        unsigned query_weight = 8;
+        unsigned plan_weight = 1;
+        unsigned invalid_weight = 1;
+        unsigned max_legs = 3;
+        unsigned seed = 2019;
+        bool emit = false;
+    };
+
+    // Rodzaje linii, dla których mierzymy czas rozpatrywania
+    enum line_kind {
+        COURSE, TICKET, QUERY, PLAN, INVALID, KINDS
+    };
+
+    const char *kind_names[KINDS] = {"course", "ticket", "query", "plan", "invalid"};
+
+    // Zatrzymanie kursu wygenerowanego przez benchmark
+    struct generated_stop {
+        unsigned stop;
+        unsigned minute;
+    };
+
+    std::string stop_name(unsigned id) {
+        std::string res = "S";
+        do {
+            res += (char) ('a' + id % 26);
+            id /= 26;
+        } while (id > 0);
+        return res;
+    }
+
+    std::string ticket_name(unsigned id) {
+        std::string res = "bilet ";
+        do {
+            res += (char) ('A' + id % 26);
+            id /= 26;
+        } while (id > 0);
+        return res;
+    }
+
+    std::string minute_to_string(const unsigned minute) {
+        std::string res = std::to_string(minute / 60) + ":";
+        if (minute % 60 < 10) {
+            res += "0";
+        }
+        return res + std::to_string(minute % 60);
+    }
+
+    // Generuje wejście: najpierw kursy, potem bilety, a na końcu
+    // config.lines linii z zapytaniami, zapytaniami o podróż i błędnymi
+    // liniami w proporcji zadanej wagami. Zwraca rodzaj każdej linii.
+    std::vector<line_kind> generate(const workload_config &config, std::string &input) {
+        std::mt19937 random(config.seed);
+        auto uniform = [&random](unsigned from, unsigned to) {
+            return std::uniform_int_distribution<unsigned>(from, to)(random);
+        };
+        std::vector<line_kind> kinds;
+        std::vector<std::vector<generated_stop>> courses(config.courses);
+        // Dla każdego przystanku - kursy, które się na nim zatrzymują,
+        // i pozycje przystanku na ich trasach.
+        std::vector<std::vector<std::pair<unsigned, unsigned>>> stop_courses(config.stops);
+        unsigned first_minute = time_to_minutes(5, 55);
+        unsigned last_minute = time_to_minutes(21, 21);
+
+        for (unsigned i = 0; i < config.courses; i++) {
+            unsigned length = uniform(2, std::min(30u, std::max(2u, config.stops)));
+            unsigned minute = uniform(first_minute, last_minute - 2 * length);
+            input += std::to_string(i);
+            for (unsigned j = 0; j < length && minute <= last_minute; j++) {
+                unsigned stop = uniform(0, config.stops - 1);
+                bool repeated = false;
+                for (auto &previous : courses[i]) {
+                    repeated |= previous.stop == stop;
+                }
+                if (repeated) continue;
+                stop_courses[stop].emplace_back(i, courses[i].size());
+                courses[i].push_back({stop, minute});
+                input += " " + minute_to_string(minute) + " " + stop_name(stop);
+                minute += uniform(1, 2);
+            }
+            input += "\n";
+            kinds.push_back(courses[i].size() >= 2 ? COURSE : INVALID);
+        }
+
+        for (unsigned i = 0; i < config.tickets; i++) {
+            unsigned price = uniform(100, 10000);
+            input += ticket_name(i) + " " + std::to_string(price / 100) + "." + std::to_string(price / 10 % 10)
+                     + std::to_string(price % 10) + " " + std::to_string(uniform(10, 400)) + "\n";
+            kinds.push_back(TICKET);
+        }
+
+        unsigned total_weight = config.query_weight + config.plan_weight + config.invalid_weight;
+        for (unsigned i = 0; i < config.lines && total_weight > 0 && config.courses > 0; i++) {
+            unsigned draw = uniform(1, total_weight);
+            unsigned course = uniform(0, config.courses - 1);
+            auto &route = courses[course];
+            if (route.size() < 2 || draw > config.query_weight + config.plan_weight) {
+                input += "? " + stop_name(uniform(0, config.stops - 1)) + " x\n";
+                kinds.push_back(INVALID);
+            } else if (draw > config.query_weight) {
+                unsigned from = uniform(0, route.size() - 1);
+                input += "? " + stop_name(route[from].stop) + " " + minute_to_string(route[from].minute) + " "
+                         + stop_name(uniform(0, config.stops - 1)) + "\n";
+                kinds.push_back(PLAN);
+            } else {
+                // Kolejne odcinki przesiadają się na losowy kurs zatrzymujący
+                // się na ostatnim przystanku - zwykle wymaga to czekania.
+                unsigned from = uniform(0, route.size() - 2);
+                unsigned to = uniform(from + 1, route.size() - 1);
+                input += "? " + stop_name(route[from].stop) + " " + std::to_string(course) + " "
+                         + stop_name(route[to].stop);
+                unsigned legs = uniform(1, std::max(1u, config.max_legs));
+                for (unsigned leg = 1; leg < legs; leg++) {
+                    auto &candidates = stop_courses[courses[course][to].stop];
+                    auto next = candidates[uniform(0, candidates.size() - 1)];
+                    if (next.second + 1 >= courses[next.first].size()) break;
+                    course = next.first;
+                    to = uniform(next.second + 1, courses[course].size() - 1);
+                    input += " " + std::to_string(course) + " " + stop_name(courses[course][to].stop);
+                }
+                input += "\n";
+                kinds.push_back(QUERY);
+            }
+        }
+        return kinds;
+    }
+
+    // Szczytowe zużycie pamięci w kilobajtach
+    long peak_rss() {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+
+    // Zwraca percentyl p (od 0 do 100) posortowanych czasów.
+    long long percentile(const std::vector<long long> &sorted, const double p) {
+        if (sorted.empty()) {
+            return 0;
+        }
+        size_t index = (size_t) (p / 100 * (sorted.size() - 1) + 0.5);
+        return sorted[index];
+    }
+
+    bool parse_arguments(int argc, char *argv[], workload_config &config) {
+        for (int i = 1; i < argc; i++) {
+            std::string_view arg = argv[i];
+            if (arg == "--emit") {
+                config.emit = true;
+                continue;
+            }
+            if (i + 1 == argc) {
+                return false;
+            }
+            unsigned value = strtoul(argv[++i], nullptr, 10);
+            if (arg == "--stops" && value > 0) config.stops = value;
+            else if (arg == "--courses") config.courses = value;
+            else if (arg == "--tickets") config.tickets = value;
+            else if (arg == "--lines") config.lines = value;
+            else if (arg == "--queries") config.query_weight = value;
+            else if (arg == "--plans") config.plan_weight = value;
+            else if (arg == "--invalid") config.invalid_weight = value;
+            else if (arg == "--max-legs") config.max_legs = value;
+            else if (arg == "--seed") config.seed = value;
+            else return false;
+        }
+        return true;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    workload_config config;
+    if (!parse_arguments(argc, argv, config)) {
+        std::cerr << "Usage: " << argv[0] << " [--stops n] [--courses n] [--tickets n] [--lines n]"
+                  << " [--queries n] [--plans n] [--invalid n] [--max-legs n] [--seed n] [--emit]\n";
+        return 1;
+    }
+
+    std::string input;
+    std::vector<line_kind> kinds = generate(config, input);
+    if (config.emit) {
+        std::cout << input;
+        return 0;
+    }
+    long rss_before = peak_rss();
+
+    std::vector<long long> latencies[KINDS];
+    size_t begin = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < kinds.size(); i++) {
+        size_t end = input.find('\n', begin);
+        std::string_view line(input.data() + begin, end - begin);
+        begin = end + 1;
+
+        auto line_start = std::chrono::steady_clock::now();
+        execute_line(i + 1, line);
+        auto line_end = std::chrono::steady_clock::now();
+        latencies[kinds[i]].push_back(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(line_end - line_start).count());
+        output_buffer.clear();
+        error_buffer.clear();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("lines: %zu, time: %.3f s, throughput: %.0f lines/s\n", kinds.size(), seconds,
+           kinds.size() / seconds);
+    printf("%-8s %10s %10s %10s %10s %10s   (ns)\n", "kind", "count", "p50", "p90", "p99", "max");
+    for (int kind = 0; kind < KINDS; kind++) {
+        std::vector<long long> &sorted = latencies[kind];
+        std::sort(sorted.begin(), sorted.end());
+        printf("%-8s %10zu %10lld %10lld %10lld %10lld\n", kind_names[kind], sorted.size(),
+               percentile(sorted, 50), percentile(sorted, 90), percentile(sorted, 99),
+               sorted.empty() ? 0 : sorted.back());
+    }
+    printf("peak RSS: %ld kB (%ld kB after generating input)\n", peak_rss(), rss_before);
+    return 0;
+}
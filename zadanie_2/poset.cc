@@ -1,479 +1,1986 @@
 #include <cstring>
 #include <unordered_map>
 #include <unordered_set>
-#include <queue>
-#include <utility>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <deque>
+#include <fstream>
+#include <memory_resource>
+#include <string_view>
 #include "poset.h"
 
 namespace {
 
+    //Śledzenie wywołań. Bez NDEBUG każde wywołanie TRACE wypisuje jeden
+    //wiersz na std::cerr. Z NDEBUG makro znika razem z argumentami, więc
+    //funkcje posetu nie dotykają strumieni.
 #ifndef NDEBUG
-    const bool debug = false;
+    //Napis w cudzysłowie albo NULL
+    struct quoted {
+        const char *value;
+    };
+
+    std::ostream &operator<<(std::ostream &os, quoted q) {
+        if (!q.value) {
+            return os << "NULL";
+        }
+        return os << '"' << q.value << '"';
+    }
+
+    template<typename... Args>
+    void trace(const Args &... args) {
+        static std::ios_base::Init init;
+        (std::cerr << ... << args) << '\n';
+    }
+
+#define TRACE(...) trace(__VA_ARGS__)
 #else
-    const bool debug = true;
+#define TRACE(...) ((void) 0)
 #endif
+    //Typ słowa, z którego składają się wiersze macierzy bitowej
+    using word_t = uint64_t;
+    const size_t WORD_BITS = 64;
+    //Arena posetu. Małe bloki (węzły setów i map, nazwy elementów) tnie
+    //z kawałków pamięci o rosnącym rozmiarze, a zwolnione małe bloki trzyma
+    //na listach według rozmiaru i przydziela ponownie. Duże bloki (wiersze
+    //macierzy, tablice kubełków) biorą się wprost z globalnego alokatora.
+    //release() oddaje naraz wszystkie kawałki.
+    class arena_resource : public std::pmr::memory_resource {
+        private:
+            static constexpr size_t ALIGN = 16;
+            static constexpr size_t SMALL_LIMIT = 256;
+            static constexpr size_t FIRST_CHUNK = 1024;
+            static constexpr size_t MAX_CHUNK = 1 << 16;
 
-    void cerr_init() {
-        static std::ios_base::Init init;
+            struct block_t {
+                block_t *next;
+            };
+
+            //Kawałki tworzą listę; nagłówek kawałka zajmuje ALIGN bajtów.
+            block_t *chunks = nullptr;
+            char *current = nullptr;
+            size_t left = 0;
+            size_t chunk_size = FIRST_CHUNK;
+            block_t *free_blocks[SMALL_LIMIT / ALIGN] = {};
+
+            void *do_allocate(size_t bytes, size_t alignment) override {
+                if (bytes > SMALL_LIMIT || alignment > ALIGN) {
+                    return ::operator new(bytes, std::align_val_t(alignment));
+                }
+                size_t size_class = (bytes + ALIGN - 1) / ALIGN - (bytes != 0);
+                size_t size = (size_class + 1) * ALIGN;
+                if (free_blocks[size_class] != nullptr) {
+                    block_t *block = free_blocks[size_class];
+                    free_blocks[size_class] = block->next;
+                    return block;
+                }
+                if (left < size) {
+                    block_t *chunk = static_cast<block_t *>(::operator new(ALIGN + chunk_size));
+                    chunk->next = chunks;
+                    chunks = chunk;
+                    current = reinterpret_cast<char *>(chunk) + ALIGN;
+                    left = chunk_size;
+                    chunk_size = std::min(2 * chunk_size, MAX_CHUNK);
+                }
+                void *result = current;
+                current += size;
+                left -= size;
+                return result;
+            }
+
+            void do_deallocate(void *p, size_t bytes, size_t alignment) override {
+                if (bytes > SMALL_LIMIT || alignment > ALIGN) {
+                    ::operator delete(p, bytes, std::align_val_t(alignment));
+                    return;
+                }
+                size_t size_class = (bytes + ALIGN - 1) / ALIGN - (bytes != 0);
+                block_t *block = static_cast<block_t *>(p);
+                block->next = free_blocks[size_class];
+                free_blocks[size_class] = block;
+            }
+
+            bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+                return this == &other;
+            }
+
+        public:
+            arena_resource() = default;
+            arena_resource(const arena_resource &) = delete;
+            arena_resource &operator=(const arena_resource &) = delete;
+
+            ~arena_resource() override {
+                release();
+            }
+
+            //Zwalnia wszystkie kawałki. Duże bloki trzeba oddać wcześniej.
+            void release() {
+                while (chunks != nullptr) {
+                    block_t *next = chunks->next;
+                    ::operator delete(chunks);
+                    chunks = next;
+                }
+                current = nullptr;
+                left = 0;
+                chunk_size = FIRST_CHUNK;
+                std::fill_n(free_blocks, SMALL_LIMIT / ALIGN, nullptr);
+            }
+    };
+
+    //Typ seta trzymającego identyfikatory elementów
+    using neighbours_set_t = std::pmr::unordered_set<uint64_t>;
+
+    //Typ mapy trzymającej identyfikatory dla każdego stringa. Klucze
+    //wskazują nazwy skopiowane do areny posetu.
+    using string_id_map_t = std::pmr::unordered_map<std::string_view, uint64_t>;
+
+    //Przybliżony koszt pamięciowy reprezentacji rzadkiej: pustego seta
+    //sąsiadów oraz jednej pary w secie (węzeł, kubełek i narzut alokatora).
+    const size_t SPARSE_SET_BYTES = sizeof(neighbours_set_t);
+    const size_t SPARSE_PAIR_BYTES = 48;
+
+    //Liczba etykietowań przedziałowych w indeksie osiągalności
+    const size_t LABELINGS = 2;
+
+    //Etykieta elementu v w indeksie osiągalności diagramu Hassego. Każde
+    //z LABELINGS przejść diagramu w głąb (z inną kolejnością pokryć) numeruje
+    //elementy w porządku post-order: post[k] to numer v, a low[k] - najmniejszy
+    //numer wśród v i elementów nad nim. Jeżeli v poprzedza w, przedział
+    //[low[k], post[k]] elementu w zawiera się w przedziale v, więc brak
+    //zawierania wyklucza relację. first to numer nadany pierwszemu elementowi
+    //zakończonemu po wejściu do v w pierwszym przejściu - elementy
+    //o post[0] z przedziału [first, post[0]] leżą w poddrzewie v, więc v je
+    //poprzedza.
+    struct label_t {
+        uint32_t first;
+        uint32_t low[LABELINGS];
+        uint32_t post[LABELINGS];
+    };
+
+    //Poset przechowuje domknięcie przechodnie relacji w jednej z dwóch
+    //reprezentacji, wybieranej automatycznie według tego, która zajmuje
+    //mniej pamięci:
+    //- gęstej (dense == true): macierz bitowa, w której wiersz successors
+    //  elementu v ma ustawione bity elementów, które v poprzedza, a wiersz
+    //  predecessors - bity elementów poprzedzających v. Oba wiersze mają po
+    //  words słów, a macierz mieści words * WORD_BITS elementów;
+    //- rzadkiej (dense == false): sety sąsiadów sparse_successors
+    //  i sparse_predecessors indeksowane identyfikatorem elementu.
+    //Identyfikatory usuniętych elementów trafiają do free_ids i są używane
+    //ponownie, więc obie reprezentacje rosną tylko z liczbą elementów.
+    //Identyfikatory elementów są też uchwytami zwracanymi przez
+    //poset_lookup. element_ids przypisuje nazwom identyfikatory, a names
+    //wskazuje nazwę elementu o danym identyfikatorze (nullptr dla wolnych
+    //identyfikatorów). pairs to liczba par elementów w relacji.
+    //
+    //Niezależnie od reprezentacji domknięcia poset trzyma diagram Hassego:
+    //sety cover_successors i cover_predecessors z parami v < w, między
+    //którymi nie leży żaden element (pokryciami). poset_del usuwa tylko
+    //pokrycia, więc sprawdza to jednym odczytem seta.
+    //
+    //W trybie diagramu Hassego (hasse == true, włączanym przez
+    //poset_set_hasse) poset nie trzyma domknięcia wcale, więc zajmuje pamięć
+    //liniową względem liczby elementów i pokryć. poset_test korzysta wtedy
+    //z indeksu osiągalności: etykiet labels i kopii pokryć w tablicach
+    //(index_offsets, index_targets). Indeks po każdej zmianie jest
+    //unieważniany (index_valid) i budowany leniwie przez zapytania, pod
+    //osobnym mutexem index_mutex, bo zapytania trzymają posetu tylko
+    //współdzielenie. Dlatego indeks nie pochodzi z areny.
+    //
+    //Wszystkie kontenery posetu i nazwy jego elementów są przydzielane
+    //z areny posetu, więc dodawanie elementów i relacji nie sięga do
+    //globalnego alokatora za każdym razem, a poset_clear i poset_delete
+    //oddają pamięć całymi kawałkami areny.
+    //
+    //Posety leżą w slotach tablicy posetów. Identyfikator posetu składa się
+    //z numeru slotu i numeru pokolenia (generation), zwiększanego przy
+    //usuwaniu posetu, więc identyfikator usuniętego posetu nie wskazuje
+    //posetu utworzonego później w tym samym slocie. Mutex chroni cały slot:
+    //poset_test i poset_size biorą go współdzielenie, a operacje zmieniające
+    //poset - na wyłączność.
+    struct poset_t {
+        std::shared_mutex mutex;
+        uint32_t generation = 0;
+        bool alive = false;
+        arena_resource arena;
+        bool dense = true;
+        size_t words = 0;
+        std::pmr::vector<word_t> successors{&arena};
+        std::pmr::vector<word_t> predecessors{&arena};
+        std::pmr::vector<neighbours_set_t> sparse_successors{&arena};
+        std::pmr::vector<neighbours_set_t> sparse_predecessors{&arena};
+        string_id_map_t element_ids{&arena};
+        std::pmr::vector<const char *> names{&arena};
+        std::pmr::vector<uint64_t> free_ids{&arena};
+        uint64_t next_id = 0;
+        size_t pairs = 0;
+        std::pmr::vector<neighbours_set_t> cover_successors{&arena};
+        std::pmr::vector<neighbours_set_t> cover_predecessors{&arena};
+        bool hasse = false;
+        std::vector<label_t> labels;
+        std::vector<size_t> index_offsets;
+        std::vector<uint64_t> index_targets;
+        std::mutex index_mutex;
+        std::atomic<bool> index_valid{false};
+        std::atomic<size_t> unindexed_work{0};
+    };
+
+    //Identyfikator posetu to numer slotu na SLOT_BITS najmłodszych bitach
+    //i numer pokolenia na pozostałych. Slot o numerze SLOT_MASK nigdy nie
+    //jest zajmowany, więc identyfikator UINT32_MAX nie wskazuje posetu.
+    //Slot, którego pokolenie doszło do MAX_GENERATION, nie wraca po usunięciu
+    //posetu na listę wolnych slotów, bo kolejne pokolenie powtórzyłoby
+    //identyfikatory dawno usuniętych posetów.
+    const uint32_t SLOT_BITS = 22;
+    const uint32_t SLOT_MASK = (1u << SLOT_BITS) - 1;
+    const uint32_t MAX_GENERATION = UINT32_MAX >> SLOT_BITS;
+    //Sloty są przydzielane kawałkami po CHUNK_SIZE i nigdy nie są
+    //przenoszone, więc do slotu można sięgnąć bez blokowania tablicy.
+    const uint32_t CHUNK_BITS = 10;
+    const uint32_t CHUNK_SIZE = 1u << CHUNK_BITS;
+    const uint32_t CHUNKS = 1u << (SLOT_BITS - CHUNK_BITS);
+
+    //Tablica posetów. Mutex chroni listę wolnych slotów, licznik zajętych
+    //slotów i przydzielanie kawałków. Wolne sloty są używane ponownie
+    //w kolejności zwalniania, żeby pokolenia pojedynczego slotu rosły jak
+    //najwolniej.
+    struct poset_table_t {
+        std::atomic<poset_t *> chunks[CHUNKS] = {};
+        std::mutex mutex;
+        std::deque<uint32_t> free_slots;
+        uint32_t used_slots = 0;
+
+        ~poset_table_t() {
+            for (uint32_t i = 0; i < CHUNKS; ++i) {
+                delete[] chunks[i].load();
+            }
+        }
+    };
+
+    poset_table_t &get_poset_table() {
+        static poset_table_t table;
+        return table;
+    }
+
+    using read_lock_t = std::shared_lock<std::shared_mutex>;
+    using write_lock_t = std::unique_lock<std::shared_mutex>;
+
+    //Jeżeli istnieje poset o identyfikatorze id, blokuje go blokadą lock
+    //i zwraca wskaźnik na niego, a w przeciwnym przypadku zwraca nullptr.
+    template<typename Lock>
+    poset_t *lock_poset(uint32_t id, Lock &lock) {
+        uint32_t slot = id & SLOT_MASK;
+        poset_t *chunk = get_poset_table().chunks[slot >> CHUNK_BITS].load(std::memory_order_acquire);
+        if (chunk == nullptr) {
+            return nullptr;
+        }
+        poset_t *p = &chunk[slot & (CHUNK_SIZE - 1)];
+        lock = Lock(p->mutex);
+        if (!p->alive || p->generation != id >> SLOT_BITS) {
+            lock.unlock();
+            return nullptr;
+        }
+        return p;
     }
-    //Typ seta trzymającego identyfikatory stringów
-    using neighbours_set_t = std::unordered_set<uint64_t>;
-    //Typ  mapy trzymającej sąsiadów dla każdego identyfikatora stringa
-    using poset_t = std::unordered_map<uint64_t, neighbours_set_t>;
-    //Typ mapy trzymającej identyfikatory dla każdego stringa
-    using string_id_map_t = std::unordered_map<std::string, uint64_t>;
 
-    //Mapa, która przechowuje grafy reprezentujące posety
-    std::unordered_map <uint32_t, poset_t> &get_posets() {
-        static std::unordered_map <uint32_t, poset_t> posets;
-        return posets;
+    bool same_value(const char *v1, const char *v2) {
+        return strcmp(v1, v2) == 0;
     }
 
-    //Mapa, która przechowuje transponowane graft reprezentujące posety
-    std::unordered_map <uint32_t, poset_t> &get_transposed() {
-        static std::unordered_map <uint32_t, poset_t> transposed;
-        return transposed;
+    //Zwalnia pamięć kontenera, oddając ją do areny, z której pochodzi.
+    template<typename Container>
+    void release(Container &c) {
+        c = Container(c.get_allocator());
     }
 
-    //Mapa, która dla każdego posetu przechowuje stringi z nazwami i nadaje im identyfikator
-    std::unordered_map <uint32_t, std::pair<string_id_map_t, uint64_t>> &get_string_map() {
-        static std::unordered_map <uint32_t, std::pair<string_id_map_t, uint64_t>> string_maps;
-        return string_maps;
+    word_t *successors_row(poset_t &p, uint64_t v) {
+        return p.successors.data() + v * p.words;
     }
 
-    //Zmienna służąca nadaniu unikatowych id dla nowych posetów
-    uint32_t next_poset_id;
-//    uint32_t &get_next_poset_id() {
-//        static uint32_t next_poset_id;
-//        return next_poset_id;
-//    }
+    word_t *predecessors_row(poset_t &p, uint64_t v) {
+        return p.predecessors.data() + v * p.words;
+    }
 
-    bool same_value(const char *v1, const char *v2) {
-        return strcmp(v1, v2) == 0;
+    bool test_bit(const word_t *row, uint64_t v) {
+        return (row[v / WORD_BITS] >> (v % WORD_BITS)) & 1;
     }
 
-    //Sprawdza istnienie posetu o danym id
-    bool poset_exists(uint32_t id) {
-        std::unordered_map <uint32_t, poset_t> &posets = get_posets();
-        return posets.count(id) > 0;
+    void set_bit(word_t *row, uint64_t v) {
+        row[v / WORD_BITS] |= (word_t) 1 << (v % WORD_BITS);
     }
 
-    //Jeżeli istnieje ścieżka w fanym posecie z v1 do v2 długości 2 zwraca true, w przeciwnym
-    //przypadku zwraca false.
-    bool longer_path(uint32_t id, uint64_t v1, uint64_t v2) {
-        std::unordered_map <uint32_t, poset_t> &posets = get_posets();
+    void reset_bit(word_t *row, uint64_t v) {
+        row[v / WORD_BITS] &= ~((word_t) 1 << (v % WORD_BITS));
+    }
 
-        poset_t &posets_id = posets[id];
-        neighbours_set_t &outgoing = posets_id[v1];
+    //Dopisuje do wiersza dst bity wiersza src i zwraca liczbę nowych bitów.
+    //Prosta pętla po słowach, którą kompilator wektoryzuje instrukcjami SIMD.
+    size_t or_row(word_t *__restrict dst, const word_t *__restrict src, size_t words) {
+        size_t added = 0;
+        for (size_t i = 0; i < words; ++i) {
+            added += __builtin_popcountll(src[i] & ~dst[i]);
+            dst[i] |= src[i];
+        }
+        return added;
+    }
 
-        for (auto it = outgoing.begin(); it != outgoing.end(); ++it) {
-            for (auto it2 = posets_id[*it].begin(); it2 != posets_id[*it].end(); ++it2) {
-                if (*it2 == v2) {
+    //Wywołuje f(v) dla każdego elementu v, którego bit jest ustawiony w wierszu.
+    template<typename F>
+    void for_each_bit(const word_t *row, size_t words, F f) {
+        for (size_t i = 0; i < words; ++i) {
+            for (word_t w = row[i]; w != 0; w &= w - 1) {
+                f(i * WORD_BITS + __builtin_ctzll(w));
+            }
+        }
+    }
+
+    //Znaczniki odwiedzin i stos przeszukiwań diagramu Hassego. Każdy wątek
+    //ma własne, bo poset_test przeszukuje diagram pod blokadą
+    //współdzieloną. Każde przeszukiwanie dostaje nowy numer epoch, więc
+    //znaczników nie trzeba czyścić, ale przeszukiwania nie mogą się
+    //zagnieżdżać.
+    struct search_t {
+        std::vector<uint64_t> marks;
+        std::vector<uint64_t> stack;
+        uint64_t epoch = 0;
+    };
+
+    search_t &start_search(const poset_t &p) {
+        thread_local search_t search;
+        if (search.marks.size() < p.next_id) {
+            search.marks.resize(p.next_id, 0);
+        }
+        search.stack.clear();
+        ++search.epoch;
+        return search;
+    }
+
+    bool visited(const search_t &search, uint64_t v) {
+        return search.marks[v] == search.epoch;
+    }
+
+    //Oznacza v jako odwiedzony i zwraca true, jeżeli nie był odwiedzony.
+    bool visit(search_t &search, uint64_t v) {
+        if (visited(search, v)) {
+            return false;
+        }
+        search.marks[v] = search.epoch;
+        return true;
+    }
+
+    //Przechodzi diagram Hassego w głąb od v - w górę po pokryciach, gdy
+    //upward == true, a w dół w przeciwnym przypadku - i wywołuje f(w) dla
+    //każdego osiągniętego elementu w różnego od v. Zwraca przeszukiwanie,
+    //którego znaczniki są ważne do rozpoczęcia następnego.
+    template<typename F>
+    const search_t &hasse_search(poset_t &p, uint64_t v, bool upward, F f) {
+        std::pmr::vector<neighbours_set_t> &covers = upward ? p.cover_successors : p.cover_predecessors;
+        search_t &search = start_search(p);
+        visit(search, v);
+        search.stack.push_back(v);
+        while (!search.stack.empty()) {
+            uint64_t u = search.stack.back();
+            search.stack.pop_back();
+            for (uint64_t w : covers[u]) {
+                if (visit(search, w)) {
+                    search.stack.push_back(w);
+                    f(w);
+                }
+            }
+        }
+        return search;
+    }
+
+    //Sprawdza przeszukiwaniem diagramu Hassego w głąb, czy v1 poprzedza v2,
+    //i dolicza do work liczbę odwiedzonych elementów.
+    bool search_reachable(poset_t &p, uint64_t v1, uint64_t v2, size_t &work) {
+        search_t &search = start_search(p);
+        visit(search, v1);
+        search.stack.push_back(v1);
+        while (!search.stack.empty()) {
+            uint64_t u = search.stack.back();
+            search.stack.pop_back();
+            ++work;
+            for (uint64_t w : p.cover_successors[u]) {
+                if (w == v2) {
                     return true;
                 }
+                if (visit(search, w)) {
+                    search.stack.push_back(w);
+                }
             }
         }
         return false;
     }
 
-    //Domyka relację przechodnio. Dodaje relacje z v1 do wszystkich elementów
-    //z którymi v2 jest w relacji.
-    void transitive_closure(uint32_t id, uint64_t v1, uint64_t v2) {
-        std::unordered_map <uint32_t, poset_t> &posets = get_posets();
-
-        poset_t &posets_id = posets[id];
-        neighbours_set_t &outgoing1 = posets_id[v1];
-        neighbours_set_t &outgoing2 = posets_id[v2];
+    //Buduje indeks osiągalności. Pokrycia przepisujemy do tablic (offsets,
+    //targets), żeby kolejne przejścia mogły je przeglądać w różnej
+    //kolejności: parzyste od początku, nieparzyste od końca, a zapytania -
+    //bez skakania po węzłach setów. Przejścia zaczynają się od elementów
+    //minimalnych, a w diagramie bez cykli odwiedzony element jest już
+    //zakończony.
+    void build_index(poset_t &p) {
+        size_t n = p.next_id;
+        std::vector<size_t> &offsets = p.index_offsets;
+        std::vector<uint64_t> &targets = p.index_targets;
+        offsets.assign(n + 1, 0);
+        targets.clear();
+        for (uint64_t v = 0; v < n; ++v) {
+            offsets[v] = targets.size();
+            targets.insert(targets.end(), p.cover_successors[v].begin(), p.cover_successors[v].end());
+        }
+        offsets[n] = targets.size();
 
-        for (auto it = outgoing2.begin(); it != outgoing2.end(); ++it) {
-            if (outgoing1.find(*it) == outgoing1.end()) {
-                outgoing1.insert(*it);
-                posets_id[*it].insert(v1);
+        p.labels.assign(n, label_t());
+        std::vector<char> seen(n);
+        std::vector<std::pair<uint64_t, size_t>> stack;
+        for (size_t k = 0; k < LABELINGS; ++k) {
+            uint32_t counter = 0;
+            std::fill(seen.begin(), seen.end(), 0);
+            auto enter = [&p, &seen, &stack, &counter, k](uint64_t v) {
+                seen[v] = 1;
+                p.labels[v].low[k] = UINT32_MAX;
+                if (k == 0) {
+                    p.labels[v].first = counter;
+                }
+                stack.emplace_back(v, 0);
+            };
+            for (uint64_t i = 0; i < n; ++i) {
+                uint64_t root = k % 2 == 0 ? i : n - 1 - i;
+                if (seen[root] || !p.cover_predecessors[root].empty()) {
+                    continue;
+                }
+                enter(root);
+                while (!stack.empty()) {
+                    uint64_t u = stack.back().first;
+                    size_t &next = stack.back().second;
+                    label_t &label = p.labels[u];
+                    if (next < offsets[u + 1] - offsets[u]) {
+                        size_t j = k % 2 == 0 ? offsets[u] + next : offsets[u + 1] - 1 - next;
+                        ++next;
+                        uint64_t w = targets[j];
+                        if (!seen[w]) {
+                            enter(w);
+                        } else {
+                            label.low[k] = std::min(label.low[k], p.labels[w].low[k]);
+                        }
+                        continue;
+                    }
+                    label.post[k] = counter++;
+                    label.low[k] = std::min(label.low[k], label.post[k]);
+                    stack.pop_back();
+                    if (!stack.empty()) {
+                        label_t &parent = p.labels[stack.back().first];
+                        parent.low[k] = std::min(parent.low[k], label.low[k]);
+                    }
+                }
             }
         }
+    }
 
+    //Sprawdza, czy przedziały etykiety a zawierają przedziały etykiety b.
+    bool label_contains(const label_t &a, const label_t &b) {
+        for (size_t k = 0; k < LABELINGS; ++k) {
+            if (b.low[k] < a.low[k] || a.post[k] < b.post[k]) {
+                return false;
+            }
+        }
+        return true;
     }
 
-    //Pomocnicza funkcja sprawdzająca czy value1 i value2 sa w relacji o indeksie id
-    bool poset_test_internal(uint32_t id, const char *value1, const char *value2) {
-        std::unordered_map <uint32_t, poset_t> &posets = get_posets();
-        std::unordered_map <uint32_t, std::pair<string_id_map_t, uint64_t>> &string_maps = get_string_map();
-        string_id_map_t &m = string_maps[id].first;
+    //Sprawdza, czy b leży w poddrzewie a pierwszego przejścia.
+    bool tree_contains(const label_t &a, const label_t &b) {
+        return a.first <= b.post[0] && b.post[0] <= a.post[0];
+    }
 
-        if (same_value(value1, value2)) {
+    //Sprawdza indeksem, czy v1 poprzedza v2. Przeszukiwanie w głąb wchodzi
+    //tylko do pokryć, których przedziały zawierają przedziały v2.
+    bool index_reachable(poset_t &p, uint64_t v1, uint64_t v2) {
+        const label_t &target = p.labels[v2];
+        if (tree_contains(p.labels[v1], target)) {
             return true;
         }
-        uint64_t v1 = m[value1];
-        uint64_t v2 = m[value2];
-        neighbours_set_t &outgoing = posets[id][v1];
-        return outgoing.find(v2) != outgoing.end();
+        if (!label_contains(p.labels[v1], target)) {
+            return false;
+        }
+        search_t &search = start_search(p);
+        visit(search, v1);
+        search.stack.push_back(v1);
+        while (!search.stack.empty()) {
+            uint64_t u = search.stack.back();
+            search.stack.pop_back();
+            for (size_t j = p.index_offsets[u]; j < p.index_offsets[u + 1]; ++j) {
+                uint64_t w = p.index_targets[j];
+                const label_t &label = p.labels[w];
+                if (w == v2 || tree_contains(label, target)) {
+                    return true;
+                }
+                if (label_contains(label, target) && visit(search, w)) {
+                    search.stack.push_back(w);
+                }
+            }
+        }
+        return false;
     }
-}
 
-namespace jnp1 {
-    uint32_t poset_new() {
-        cerr_init();
-        if (debug) {
-            std::cerr << "poset_new()\n";
+    //Sprawdza w trybie diagramu Hassego, czy v1 poprzedza v2. Po zmianie
+    //diagramu zapytania przeszukują go w głąb bez indeksu, a indeks jest
+    //budowany dopiero wtedy, gdy przeszukiwania odwiedziły łącznie tyle
+    //elementów, ile ma poset - seria zmian przeplatanych pojedynczymi
+    //zapytaniami nie przebudowuje go za każdym razem.
+    bool hasse_reachable(poset_t &p, uint64_t v1, uint64_t v2) {
+        if (p.index_valid.load(std::memory_order_acquire)) {
+            return index_reachable(p, v1, v2);
+        }
+        size_t work = 0;
+        bool result = search_reachable(p, v1, v2, work);
+        if (p.unindexed_work.fetch_add(work, std::memory_order_relaxed) + work >= p.next_id) {
+            std::lock_guard<std::mutex> lock(p.index_mutex);
+            if (!p.index_valid.load(std::memory_order_relaxed)) {
+                build_index(p);
+                p.index_valid.store(true, std::memory_order_release);
+            }
         }
-        //next_poset_id = get_next_poset_id();
-        std::unordered_map <uint32_t, poset_t> &posets = get_posets();
-        std::unordered_map <uint32_t, poset_t> &transposed = get_transposed();
-        std::unordered_map <uint32_t, std::pair<string_id_map_t, uint64_t>> &string_maps = get_string_map();
+        return result;
+    }
 
-        posets[next_poset_id].clear();
-        transposed[next_poset_id].clear();
-        std::pair <string_id_map_t, uint64_t> &string_map_id = string_maps[next_poset_id];
-        string_map_id.first.clear();
-        string_map_id.second = 0;
-        if (debug) {
-            std::cerr << "poset_new: poset " << next_poset_id << " created\n";
+    //Unieważnia indeks osiągalności po zmianie diagramu Hassego.
+    void invalidate_index(poset_t &p) {
+        p.index_valid.store(false, std::memory_order_relaxed);
+        p.unindexed_work.store(0, std::memory_order_relaxed);
+    }
+
+    //Przepisuje macierz do wierszy długości words słów.
+    void resize_matrix(poset_t &p, size_t words) {
+        std::pmr::vector<word_t> successors(words * WORD_BITS * words, &p.arena);
+        std::pmr::vector<word_t> predecessors(words * WORD_BITS * words, &p.arena);
+        for (uint64_t v = 0; v < p.next_id; ++v) {
+            std::copy_n(successors_row(p, v), p.words, successors.data() + v * words);
+            std::copy_n(predecessors_row(p, v), p.words, predecessors.data() + v * words);
         }
-        return next_poset_id++;
+        p.words = words;
+        p.successors.swap(successors);
+        p.predecessors.swap(predecessors);
     }
 
-    void poset_delete(uint32_t id) {
-        cerr_init();
-        if (debug) {
-            std::cerr << "poset_delete(" << id << ")\n";
+    //Liczba słów wiersza macierzy bitowej dla n elementów. Jest potęgą
+    //dwójki, tak jak po kolejnych resize_matrix w new_element.
+    size_t matrix_words(uint64_t n) {
+        size_t words = 1;
+        while (words * WORD_BITS < n) {
+            words *= 2;
         }
-        std::unordered_map <uint32_t, poset_t> &posets = get_posets();
-        std::unordered_map <uint32_t, poset_t> &transposed = get_transposed();
-        std::unordered_map <uint32_t, std::pair<string_id_map_t, uint64_t>> &string_maps = get_string_map();
+        return words;
+    }
 
-        if (poset_exists(id)) {
-            posets.erase(id);
-            transposed.erase(id);
-            string_maps.erase(id);
-            if (debug) {
-                std::cerr << "poset_delete: poset " << id << " deleted\n";
+    //Zamienia reprezentację rzadką na macierz bitową.
+    void make_dense(poset_t &p) {
+        size_t words = matrix_words(p.next_id);
+        p.words = words;
+        p.successors.assign(words * WORD_BITS * words, 0);
+        p.predecessors.assign(words * WORD_BITS * words, 0);
+        for (uint64_t v = 0; v < p.next_id; ++v) {
+            for (uint64_t w : p.sparse_successors[v]) {
+                set_bit(successors_row(p, v), w);
+                set_bit(predecessors_row(p, w), v);
             }
+        }
+        release(p.sparse_successors);
+        release(p.sparse_predecessors);
+        p.dense = true;
+    }
+
+    //Zamienia macierz bitową na reprezentację rzadką.
+    void make_sparse(poset_t &p) {
+        p.sparse_successors.resize(p.next_id);
+        p.sparse_predecessors.resize(p.next_id);
+        for (uint64_t v = 0; v < p.next_id; ++v) {
+            for_each_bit(successors_row(p, v), p.words, [&p, v](uint64_t w) {
+                p.sparse_successors[v].insert(w);
+                p.sparse_predecessors[w].insert(v);
+            });
+        }
+        p.words = 0;
+        release(p.successors);
+        release(p.predecessors);
+        p.dense = false;
+    }
+
+    //Pamięć domknięcia w macierzy bitowej - dokładnie tyle, ile przydziela
+    //make_dense: dwie macierze po words * WORD_BITS wierszy.
+    size_t dense_bytes(const poset_t &p) {
+        size_t words = matrix_words(p.next_id);
+        return 2 * words * WORD_BITS * words * sizeof(word_t);
+    }
+
+    //Szacunkowa pamięć domknięcia w reprezentacji rzadkiej
+    size_t sparse_bytes(const poset_t &p) {
+        return 2 * (p.next_id * SPARSE_SET_BYTES + p.pairs * SPARSE_PAIR_BYTES);
+    }
+
+    //Wybiera reprezentację zajmującą mniej pamięci. Do gęstej przechodzimy,
+    //gdy jest mniejsza od rzadkiej, a do rzadkiej dopiero, gdy ta jest
+    //dwukrotnie mniejsza od gęstej, żeby poset na granicy nie był
+    //przepisywany przy każdej operacji. W trybie diagramu Hassego poset nie
+    //ma domknięcia, więc nie ma czego wybierać.
+    void choose_representation(poset_t &p) {
+        if (p.hasse) {
             return;
         }
-        if (debug) {
-            std::cerr << "poset_delete: poset " << id << " does  not exist\n";
+        if (p.dense && 2 * sparse_bytes(p) < dense_bytes(p)) {
+            make_sparse(p);
+        } else if (!p.dense && dense_bytes(p) < sparse_bytes(p)) {
+            make_dense(p);
         }
-        return;
     }
 
-    size_t poset_size(uint32_t id) {
-        cerr_init();
-        if (debug) {
-            std::cerr << "poset_size(" << id << ")\n";
+    //Dodaje do posetu element o nazwie value, który nie jest w relacji
+    //z żadnym innym, i zwraca jego identyfikator.
+    uint64_t new_element(poset_t &p, const char *value) {
+        size_t length = strlen(value);
+        char *name = static_cast<char *>(p.arena.allocate(length + 1, 1));
+        std::copy_n(value, length + 1, name);
+        invalidate_index(p);
+        if (!p.free_ids.empty()) {
+            uint64_t v = p.free_ids.back();
+            p.free_ids.pop_back();
+            p.names[v] = name;
+            p.element_ids.emplace(std::string_view(name, length), v);
+            return v;
         }
-        std::unordered_map <uint32_t, std::pair<string_id_map_t, uint64_t>> &string_maps = get_string_map();
+        p.names.push_back(name);
+        p.element_ids.emplace(std::string_view(name, length), p.next_id);
+        p.cover_successors.emplace_back();
+        p.cover_predecessors.emplace_back();
+        if (p.dense) {
+            if (p.next_id == p.words * WORD_BITS) {
+                resize_matrix(p, p.words == 0 ? 1 : 2 * p.words);
+            }
+        } else if (!p.hasse) {
+            p.sparse_successors.emplace_back();
+            p.sparse_predecessors.emplace_back();
+        }
+        return p.next_id++;
+    }
+
+    //Sprawdza, czy v1 poprzedza v2.
+    bool relation_test(poset_t &p, uint64_t v1, uint64_t v2) {
+        if (p.dense) {
+            return test_bit(successors_row(p, v1), v2);
+        }
+        if (p.hasse) {
+            return hasse_reachable(p, v1, v2);
+        }
+        return p.sparse_successors[v1].count(v2) > 0;
+    }
 
-        if (string_maps.count(id)) {
-            size_t s = string_maps[id].first.size();
-            if (debug) {
-                std::cerr << "poset_size: poset " << id << " contains " << s << " elements\n";
+    //Sprawdza, czy v2 pokrywa v1, czyli czy v1 poprzedza v2 i żaden
+    //element nie leży między nimi.
+    bool is_cover(poset_t &p, uint64_t v1, uint64_t v2) {
+        return p.cover_successors[v1].count(v2) > 0;
+    }
+
+    void add_cover(poset_t &p, uint64_t v1, uint64_t v2) {
+        p.cover_successors[v1].insert(v2);
+        p.cover_predecessors[v2].insert(v1);
+    }
+
+    //Usuwa pokrycia u < w, dla których above(w) jest prawdą. Wywołujemy ją
+    //dla u poprzedzających nową parę v1 < v2 (oraz dla samego v1), a above
+    //wskazuje v2 i jego następników - między u i takim w leży teraz v1
+    //lub v2.
+    template<typename F>
+    void break_covers(poset_t &p, uint64_t u, F above) {
+        neighbours_set_t &covers = p.cover_successors[u];
+        for (auto it = covers.begin(); it != covers.end();) {
+            if (above(*it)) {
+                p.cover_predecessors[*it].erase(u);
+                it = covers.erase(it);
+            } else {
+                ++it;
             }
-            return s;
         }
-        if (debug) {
-            std::cerr << "poset_size: poset " << id << " does not exist\n";
+    }
+
+    //Sprawdza, czy między u i x leży jakiś element inny niż skip, gdzie
+    //x pokrywa skip. Wystarczy przejrzeć pokrycia u: każdy element leżący
+    //między u i x leży nad którymś z nich, a skip nie leży pod żadnym
+    //elementem mniejszym od x.
+    bool other_between(poset_t &p, uint64_t u, uint64_t x, uint64_t skip) {
+        for (uint64_t c : p.cover_successors[u]) {
+            if (c != skip && relation_test(p, c, x)) {
+                return true;
+            }
         }
-        return 0;
+        return false;
     }
 
-    bool poset_insert(uint32_t id, const char *value) {
-        cerr_init();
-        if (debug) {
-            std::cerr << "poset_insert(" << id << ", \"";
-            if (!value) std::cerr << "NULL" << ")\n";
-            else std::cerr << value << "\")\n";
+    //Usuwa element v wraz z nazwą i wszystkimi jego relacjami. Domknięcie
+    //pozostałych elementów się nie zmienia, ale pary u < x, między którymi
+    //leżało tylko v, stają się pokryciami.
+    void remove_element(poset_t &p, uint64_t v) {
+        for (uint64_t u : p.cover_predecessors[v]) {
+            for (uint64_t x : p.cover_successors[v]) {
+                if (!other_between(p, u, x, v)) {
+                    add_cover(p, u, x);
+                }
+            }
+        }
+        for (uint64_t u : p.cover_predecessors[v]) {
+            p.cover_successors[u].erase(v);
         }
-        std::unordered_map <uint32_t, poset_t> &posets = get_posets();
-        std::unordered_map <uint32_t, poset_t> &transposed = get_transposed();
-        std::unordered_map <uint32_t, std::pair<string_id_map_t, uint64_t>> &string_maps = get_string_map();
+        for (uint64_t x : p.cover_successors[v]) {
+            p.cover_predecessors[x].erase(v);
+        }
+        release(p.cover_successors[v]);
+        release(p.cover_predecessors[v]);
+        if (p.dense) {
+            word_t *outgoing = successors_row(p, v);
+            word_t *incoming = predecessors_row(p, v);
+            for_each_bit(outgoing, p.words, [&p, v](uint64_t w) {
+                reset_bit(predecessors_row(p, w), v);
+                --p.pairs;
+            });
+            for_each_bit(incoming, p.words, [&p, v](uint64_t w) {
+                reset_bit(successors_row(p, w), v);
+                --p.pairs;
+            });
+            std::fill_n(outgoing, p.words, 0);
+            std::fill_n(incoming, p.words, 0);
+        } else if (!p.hasse) {
+            neighbours_set_t &outgoing = p.sparse_successors[v];
+            neighbours_set_t &incoming = p.sparse_predecessors[v];
+            for (uint64_t w : outgoing) {
+                p.sparse_predecessors[w].erase(v);
+            }
+            for (uint64_t w : incoming) {
+                p.sparse_successors[w].erase(v);
+            }
+            p.pairs -= outgoing.size() + incoming.size();
+            release(outgoing);
+            release(incoming);
+        }
+        std::string_view name = p.names[v];
+        p.element_ids.erase(name);
+        p.arena.deallocate(const_cast<char *>(name.data()), name.size() + 1, 1);
+        p.names[v] = nullptr;
+        p.free_ids.push_back(v);
+        invalidate_index(p);
+    }
 
-        if (!value) {
-            if (debug) {
-                std::cerr << "poset_insert: invalid value (NULL)\n";
+    //Usuwa parę (v1, v2) z domknięcia.
+    void delete_relation(poset_t &p, uint64_t v1, uint64_t v2) {
+        if (p.hasse) {
+            return;
+        }
+        if (p.dense) {
+            reset_bit(successors_row(p, v1), v2);
+            reset_bit(predecessors_row(p, v2), v1);
+        } else {
+            p.sparse_successors[v1].erase(v2);
+            p.sparse_predecessors[v2].erase(v1);
+        }
+        --p.pairs;
+    }
+
+    //Dodaje relację v1 < v2 i domyka ją przechodnio: każdy element
+    //poprzedzający v1 (oraz samo v1) zaczyna poprzedzać v2 i wszystko,
+    //co v2 poprzedza. Wiersze poprzedników uzupełniamy symetrycznie.
+    void transitive_closure(poset_t &p, uint64_t v1, uint64_t v2) {
+        if (!p.dense) {
+            //Poprzednicy v1 i następnicy v2 to rozłączne zbiory, więc można
+            //je przeglądać, dopisując sąsiadów innym elementom.
+            auto add_successors = [&p, v2](uint64_t u) {
+                auto add = [&p, u](uint64_t w) {
+                    if (p.sparse_successors[u].insert(w).second) {
+                        p.sparse_predecessors[w].insert(u);
+                        ++p.pairs;
+                    }
+                };
+                for (uint64_t w : p.sparse_successors[v2]) {
+                    add(w);
+                }
+                add(v2);
+            };
+            for (uint64_t u : p.sparse_predecessors[v1]) {
+                add_successors(u);
+            }
+            add_successors(v1);
+            return;
+        }
+        const word_t *outgoing2 = successors_row(p, v2);
+        const word_t *incoming1 = predecessors_row(p, v1);
+        auto add_successors = [&p, v2, outgoing2](uint64_t w) {
+            word_t *row = successors_row(p, w);
+            p.pairs += or_row(row, outgoing2, p.words) + !test_bit(row, v2);
+            set_bit(row, v2);
+        };
+        auto add_predecessors = [&p, v1, incoming1](uint64_t w) {
+            word_t *row = predecessors_row(p, w);
+            or_row(row, incoming1, p.words);
+            set_bit(row, v1);
+        };
+        for_each_bit(incoming1, p.words, add_successors);
+        add_successors(v1);
+        for_each_bit(outgoing2, p.words, add_predecessors);
+        add_predecessors(v2);
+    }
+
+    //Wywołuje f(w) dla każdego elementu w, który v poprzedza.
+    template<typename F>
+    void for_each_successor(poset_t &p, uint64_t v, F f) {
+        if (p.dense) {
+            for_each_bit(successors_row(p, v), p.words, f);
+        } else if (p.hasse) {
+            hasse_search(p, v, true, f);
+        } else {
+            for (uint64_t w : p.sparse_successors[v]) {
+                f(w);
+            }
+        }
+    }
+
+    //Wywołuje f(w) dla każdego elementu w poprzedzającego v.
+    template<typename F>
+    void for_each_predecessor(poset_t &p, uint64_t v, F f) {
+        if (p.dense) {
+            for_each_bit(predecessors_row(p, v), p.words, f);
+        } else if (p.hasse) {
+            hasse_search(p, v, false, f);
+        } else {
+            for (uint64_t w : p.sparse_predecessors[v]) {
+                f(w);
             }
+        }
+    }
+
+    //Sprawdza, czy uchwyt v wskazuje element posetu.
+    bool valid_element(const poset_t &p, uint64_t v) {
+        return v < p.next_id && p.names[v] != nullptr;
+    }
+
+    //Typ pary elementów (v1, v2) oznaczającej relację v1 < v2
+    using relation_t = std::pair<uint64_t, uint64_t>;
+
+    //Aktualizuje diagram Hassego przed dodaniem par [first, last) o wspólnym
+    //pierwszym elemencie v1, które nie były w relacji. above(w) wskazuje
+    //elementy, które zaczną następować po v1 (drugie elementy par i ich
+    //następników), a reached(w) - te z nich, które leżą nad drugim
+    //elementem którejś pary lub już następują po v1. Nowe pary przecinają
+    //pokrycia od v1 i jego poprzedników do elementów above, a pokryciami
+    //stają się pary, dla których reached jest fałszem.
+    template<typename Above, typename Reached>
+    void update_covers(poset_t &p, const relation_t *first, const relation_t *last, Above above, Reached reached) {
+        uint64_t v1 = first->first;
+        for_each_predecessor(p, v1, [&p, &above](uint64_t u) {
+            break_covers(p, u, above);
+        });
+        break_covers(p, v1, above);
+        for (const relation_t *r = first; r != last; ++r) {
+            if (!reached(r->second)) {
+                add_cover(p, v1, r->second);
+            }
+        }
+    }
+
+    //Jeżeli v1 i v2 nie są w relacji, dodaje relację v1 < v2, domyka ją
+    //przechodnio i zwraca true, a w przeciwnym przypadku zwraca false.
+    bool add_relation(poset_t &p, uint64_t v1, uint64_t v2) {
+        if (v1 == v2 || relation_test(p, v1, v2) || relation_test(p, v2, v1)) {
             return false;
         }
-        if (!poset_exists(id)) {
-            if (debug) {
-                std::cerr << "poset_insert: poset " << id << " does not exist\n";
+        if (p.hasse) {
+            //Przeszukiwanie w górę od v2 zaznacza elementy, które zaczną
+            //następować po v1, więc v1 i jego poprzedników zbieramy
+            //wcześniej.
+            std::vector<uint64_t> lower;
+            hasse_search(p, v1, false, [&lower](uint64_t u) {
+                lower.push_back(u);
+            });
+            lower.push_back(v1);
+            const search_t &upper = hasse_search(p, v2, true, [](uint64_t) {});
+            for (uint64_t u : lower) {
+                break_covers(p, u, [&upper](uint64_t w) {
+                    return visited(upper, w);
+                });
             }
+            add_cover(p, v1, v2);
+            invalidate_index(p);
+            return true;
+        }
+        relation_t relation(v1, v2);
+        auto above = [&p, v2](uint64_t w) {
+            return w == v2 || relation_test(p, v2, w);
+        };
+        update_covers(p, &relation, &relation + 1, above, [](uint64_t) {
+            return false;
+        });
+        transitive_closure(p, v1, v2);
+        choose_representation(p);
+        return true;
+    }
+
+    //Jeżeli v2 pokrywa v1, usuwa relację między v1 i v2 i zwraca true,
+    //a w przeciwnym przypadku zwraca false. Pokryciami stają się pary
+    //v1 < x dla pokryć v2 < x oraz u < v2 dla pokryć u < v1, o ile między
+    //nimi nie leży inny element.
+    bool remove_relation(poset_t &p, uint64_t v1, uint64_t v2) {
+        if (v1 == v2 || !is_cover(p, v1, v2)) {
             return false;
         }
-        std::pair <string_id_map_t, uint64_t> &string_map_id = string_maps[id];
-        if (string_map_id.first.count(value)) {
-            if (debug) {
-                std::cerr << "poset_insert: poset " << id << ", element \"";
-                std::cerr << value << "\" already exists\n";
+        for (uint64_t x : p.cover_successors[v2]) {
+            if (!other_between(p, v1, x, v2)) {
+                add_cover(p, v1, x);
             }
+        }
+        for (uint64_t u : p.cover_predecessors[v1]) {
+            if (!other_between(p, u, v2, v1)) {
+                add_cover(p, u, v2);
+            }
+        }
+        p.cover_successors[v1].erase(v2);
+        p.cover_predecessors[v2].erase(v1);
+        delete_relation(p, v1, v2);
+        invalidate_index(p);
+        choose_representation(p);
+        return true;
+    }
+
+    //Dodaje naraz relacje z listy i domyka je przechodnio. Pary już będące
+    //w relacji pomijamy, a pozostałe grupujemy według pierwszego elementu
+    //(źródła). Źródło v1 musi zostać przetworzone po źródle w, gdy któraś
+    //para (v1, v2) prowadzi do w, czyli v2 = w lub v2 poprzedza w.
+    //Przetwarzając źródła w odwrotnym porządku topologicznym tego grafu,
+    //zastajemy zbiory następników wszystkich v2 w ostatecznej postaci, więc
+    //każde źródło dopisujemy raz do siebie i swoich poprzedników. Źródło
+    //leżące pod innym może jednak zostać przetworzone po nim, więc drugie
+    //elementy jego par mogą już po nim następować - takie pary nie stają
+    //się pokryciami. Jeżeli graf źródeł ma cykl, nowe pary przeczą
+    //częściowemu porządkowi - wtedy, podobnie jak gdy wszystkie pary już są
+    //w relacji, nic nie zmienia i zwraca false.
+    bool add_relations(poset_t &p, std::vector<relation_t> &relations) {
+        auto already_related = [&p](const relation_t &r) {
+            return r.first == r.second || relation_test(p, r.first, r.second);
+        };
+        relations.erase(std::remove_if(relations.begin(), relations.end(), already_related), relations.end());
+        if (relations.empty()) {
             return false;
         }
-        uint32_t string_id = string_map_id.second++;
-        string_map_id.first[value] = string_id;
-        posets[id][string_id].clear();
-        transposed[id][string_id].clear();
-        if (debug) {
-            std::cerr << "poset_insert: poset " << id << ", element \"";
-            std::cerr << value << "\" inserted\n";
+        std::sort(relations.begin(), relations.end());
+
+        //Źródła, początki ich par na liście oraz graf źródeł
+        std::vector<uint64_t> sources;
+        std::vector<size_t> first_relation;
+        std::vector<int64_t> source_index(p.next_id, -1);
+        for (size_t i = 0; i < relations.size(); ++i) {
+            if (i == 0 || relations[i].first != relations[i - 1].first) {
+                source_index[relations[i].first] = sources.size();
+                sources.push_back(relations[i].first);
+                first_relation.push_back(i);
+            }
+        }
+        first_relation.push_back(relations.size());
+        std::vector<std::vector<size_t>> later(sources.size());
+        for (size_t s = 0; s < sources.size(); ++s) {
+            for (size_t i = first_relation[s]; i < first_relation[s + 1]; ++i) {
+                auto add_edge = [&later, &source_index, s](uint64_t w) {
+                    if (source_index[w] >= 0) {
+                        later[s].push_back(source_index[w]);
+                    }
+                };
+                add_edge(relations[i].second);
+                for_each_successor(p, relations[i].second, add_edge);
+            }
+        }
+
+        //Przeszukiwanie w głąb bez rekursji: state 1 - źródło na stosie,
+        //2 - przetworzone. Kolejność przetwarzania trafia do order.
+        std::vector<char> state(sources.size(), 0);
+        std::vector<size_t> order;
+        std::vector<std::pair<size_t, size_t>> stack;
+        for (size_t root = 0; root < sources.size(); ++root) {
+            if (state[root] != 0) {
+                continue;
+            }
+            state[root] = 1;
+            stack.emplace_back(root, 0);
+            while (!stack.empty()) {
+                size_t s = stack.back().first;
+                size_t &next = stack.back().second;
+                if (next == later[s].size()) {
+                    state[s] = 2;
+                    order.push_back(s);
+                    stack.pop_back();
+                    continue;
+                }
+                size_t t = later[s][next++];
+                if (state[t] == 1) {
+                    return false;
+                }
+                if (state[t] == 0) {
+                    state[t] = 1;
+                    stack.emplace_back(t, 0);
+                }
+            }
+        }
+
+        //Po każdym źródle poset może zmienić reprezentację, bo domknięcie
+        //wielu par naraz szybko zagęszcza relację.
+        //Wiersz reached i wartość 2 w is_target oznaczają elementy leżące
+        //nad drugim elementem którejś pary źródła.
+        std::vector<word_t> added;
+        std::vector<word_t> reached;
+        std::vector<uint64_t> targets;
+        std::vector<char> is_target(p.next_id, 0);
+        for (size_t s : order) {
+            uint64_t v1 = sources[s];
+            const relation_t *first = relations.data() + first_relation[s];
+            const relation_t *last = relations.data() + first_relation[s + 1];
+            if (p.dense) {
+                added.assign(p.words, 0);
+                reached.assign(p.words, 0);
+                for (const relation_t *r = first; r != last; ++r) {
+                    or_row(reached.data(), successors_row(p, r->second), p.words);
+                    set_bit(added.data(), r->second);
+                }
+                or_row(added.data(), reached.data(), p.words);
+                update_covers(p, first, last, [&added](uint64_t w) {
+                    return test_bit(added.data(), w);
+                }, [&p, &reached, v1](uint64_t w) {
+                    return test_bit(reached.data(), w) || test_bit(successors_row(p, v1), w);
+                });
+                auto add_successors = [&p, &added](uint64_t u) {
+                    word_t *row = successors_row(p, u);
+                    for (size_t i = 0; i < p.words; ++i) {
+                        word_t fresh = added[i] & ~row[i];
+                        row[i] |= fresh;
+                        for_each_bit(&fresh, 1, [&p, i, u](uint64_t w) {
+                            set_bit(predecessors_row(p, i * WORD_BITS + w), u);
+                            ++p.pairs;
+                        });
+                    }
+                };
+                for_each_bit(predecessors_row(p, v1), p.words, add_successors);
+                add_successors(v1);
+            } else {
+                targets.clear();
+                auto add_target = [&targets, &is_target](uint64_t w, char kind) {
+                    if (!is_target[w]) {
+                        targets.push_back(w);
+                    }
+                    is_target[w] = std::max(is_target[w], kind);
+                };
+                for (const relation_t *r = first; r != last; ++r) {
+                    add_target(r->second, 1);
+                    for_each_successor(p, r->second, [&add_target](uint64_t w) {
+                        add_target(w, 2);
+                    });
+                }
+                if (p.hasse) {
+                    hasse_search(p, v1, true, [&is_target](uint64_t w) {
+                        if (is_target[w] == 1) {
+                            is_target[w] = 2;
+                        }
+                    });
+                } else {
+                    for (const relation_t *r = first; r != last; ++r) {
+                        if (p.sparse_successors[v1].count(r->second) > 0) {
+                            is_target[r->second] = 2;
+                        }
+                    }
+                }
+                update_covers(p, first, last, [&is_target](uint64_t w) {
+                    return is_target[w] != 0;
+                }, [&is_target](uint64_t w) {
+                    return is_target[w] == 2;
+                });
+                //W trybie diagramu Hassego wystarczy zmienić pokrycia.
+                if (!p.hasse) {
+                    auto add_successors = [&p, &targets](uint64_t u) {
+                        for (uint64_t w : targets) {
+                            if (p.sparse_successors[u].insert(w).second) {
+                                p.sparse_predecessors[w].insert(u);
+                                ++p.pairs;
+                            }
+                        }
+                    };
+                    std::vector<uint64_t> from(p.sparse_predecessors[v1].begin(), p.sparse_predecessors[v1].end());
+                    from.push_back(v1);
+                    for (uint64_t u : from) {
+                        add_successors(u);
+                    }
+                }
+                for (uint64_t w : targets) {
+                    is_target[w] = 0;
+                }
+            }
+            choose_representation(p);
         }
+        invalidate_index(p);
         return true;
     }
 
-    bool poset_test(uint32_t id, const char *value1, const char *value2) {
-        cerr_init();
-        if (debug) {
-            std::cerr << "poset_test(" << id << ", ";
-            if (!value1) std::cerr << "NULL, ";
-            else std::cerr << "\"" << value1 << "\", ";
-            if (!value2) std::cerr << "NULL)\n";
-            else std::cerr << "\"" << value2 << "\")\n";
+    //Usuwa wszystkie elementy posetu i oddaje kawałki jego areny. Tryb
+    //diagramu Hassego pozostaje włączony.
+    void clear_poset(poset_t &p) {
+        p.dense = !p.hasse;
+        p.words = 0;
+        release(p.successors);
+        release(p.predecessors);
+        release(p.sparse_successors);
+        release(p.sparse_predecessors);
+        release(p.element_ids);
+        release(p.names);
+        release(p.free_ids);
+        release(p.cover_successors);
+        release(p.cover_predecessors);
+        release(p.labels);
+        release(p.index_offsets);
+        release(p.index_targets);
+        invalidate_index(p);
+        p.arena.release();
+        p.next_id = 0;
+        p.pairs = 0;
+    }
+
+    //Zapisuje w order elementy posetu w porządku topologicznym diagramu
+    //Hassego (algorytmem Kahna).
+    void topological_order(poset_t &p, std::vector<uint64_t> &order) {
+        std::vector<size_t> remaining(p.next_id);
+        order.clear();
+        for (uint64_t v = 0; v < p.next_id; ++v) {
+            remaining[v] = p.cover_predecessors[v].size();
+            if (remaining[v] == 0 && valid_element(p, v)) {
+                order.push_back(v);
+            }
         }
-        std::unordered_map <uint32_t, poset_t> &posets = get_posets();
-        std::unordered_map <uint32_t, std::pair<string_id_map_t, uint64_t>> &string_maps = get_string_map();
+        for (size_t i = 0; i < order.size(); ++i) {
+            for (uint64_t w : p.cover_successors[order[i]]) {
+                if (--remaining[w] == 0) {
+                    order.push_back(w);
+                }
+            }
+        }
+    }
 
-        if (!value1 || !value2) {
-            if (debug && !value1) {
-                std::cerr << "poset_test: invalid value1 (NULL)\n";
+    //Przełącza poset w tryb diagramu Hassego i zwalnia domknięcie.
+    void make_hasse(poset_t &p) {
+        p.dense = false;
+        p.hasse = true;
+        p.words = 0;
+        p.pairs = 0;
+        release(p.successors);
+        release(p.predecessors);
+        release(p.sparse_successors);
+        release(p.sparse_predecessors);
+        invalidate_index(p);
+    }
+
+    //Odtwarza domknięcie z diagramu Hassego: w odwrotnym porządku
+    //topologicznym każdy element dostaje swoje pokrycia i ich następników.
+    //Domknięcie powstaje w reprezentacji rzadkiej, dopóki jest mniejsza od
+    //macierzy bitowej - potem pozostałe wiersze sumujemy już w macierzy.
+    //Na końcu choose_representation wybiera reprezentację jak zwykle.
+    void make_closure(poset_t &p) {
+        std::vector<uint64_t> order;
+        topological_order(p, order);
+        p.hasse = false;
+        p.sparse_successors.resize(p.next_id);
+        p.sparse_predecessors.resize(p.next_id);
+        for (auto it = order.rbegin(); it != order.rend(); ++it) {
+            uint64_t v = *it;
+            if (p.dense) {
+                word_t *row = successors_row(p, v);
+                for (uint64_t c : p.cover_successors[v]) {
+                    set_bit(row, c);
+                    or_row(row, successors_row(p, c), p.words);
+                }
+                for_each_bit(row, p.words, [&p, v](uint64_t w) {
+                    set_bit(predecessors_row(p, w), v);
+                    ++p.pairs;
+                });
+                continue;
+            }
+            neighbours_set_t &outgoing = p.sparse_successors[v];
+            for (uint64_t c : p.cover_successors[v]) {
+                outgoing.insert(c);
+                outgoing.insert(p.sparse_successors[c].begin(), p.sparse_successors[c].end());
+            }
+            for (uint64_t w : outgoing) {
+                p.sparse_predecessors[w].insert(v);
             }
-            if (debug && !value2) {
-                std::cerr << "poset_test: invalid value2 (NULL)\n";
+            p.pairs += outgoing.size();
+            if (dense_bytes(p) < sparse_bytes(p)) {
+                make_dense(p);
+            }
+        }
+        release(p.labels);
+        release(p.index_offsets);
+        release(p.index_targets);
+        invalidate_index(p);
+        choose_representation(p);
+    }
+
+    //Zastępuje order elementami posetu uporządkowanymi według warstw
+    //i zwraca liczbę warstw. Elementy minimalne leżą w warstwie 0, a każdy
+    //inny element - o jedną warstwę wyżej niż najwyższy z elementów, które
+    //pokrywa, czyli na końcu najdłuższego łańcucha od elementu minimalnego.
+    //Dlatego elementy jednej warstwy są parami nieporównywalne. layer[v] to
+    //numer warstwy elementu v.
+    size_t layered_order(poset_t &p, std::vector<uint64_t> &order, std::vector<size_t> &layer) {
+        topological_order(p, order);
+        layer.assign(p.next_id, 0);
+        size_t layers = 0;
+        for (uint64_t v : order) {
+            for (uint64_t w : p.cover_successors[v]) {
+                layer[w] = std::max(layer[w], layer[v] + 1);
             }
+            layers = std::max(layers, layer[v] + 1);
+        }
+        //Sortowanie przez zliczanie zachowuje w warstwie porządek topologiczny.
+        std::vector<size_t> next(layers + 1, 0);
+        for (uint64_t v : order) {
+            ++next[layer[v] + 1];
+        }
+        for (size_t i = 1; i <= layers; ++i) {
+            next[i] += next[i - 1];
+        }
+        std::vector<uint64_t> sorted(order.size());
+        for (uint64_t v : order) {
+            sorted[next[layer[v]]++] = v;
+        }
+        order.swap(sorted);
+        return layers;
+    }
+
+    //Nagłówek pliku zapisywanego przez poset_save. Po nim leżą kolejno, bez
+    //odstępów:
+    //- name_offsets: elements liczb - pozycje nazw w bloku names;
+    //- cover_offsets: elements + 1 liczb i cover_targets: covers liczb -
+    //  element i pokrywają elementy cover_targets[j] dla j od
+    //  cover_offsets[i] do cover_offsets[i + 1] - 1, w kolejności rosnącej;
+    //- names: name_bytes bajtów - zakończone zerem nazwy elementów.
+    //Elementy są ponumerowane w porządku topologicznym, więc pokrycia
+    //prowadzą do elementów o większych numerach. Liczby mają po 64 bity
+    //w porządku bajtów maszyny, a wszystkie tablice są wyrównane do 8 bajtów,
+    //więc zmapowany do pamięci plik można czytać bez kopiowania.
+    struct file_header_t {
+        char magic[8];
+        uint64_t version;
+        uint64_t elements;
+        uint64_t covers;
+        uint64_t name_bytes;
+    };
+
+    const char FILE_MAGIC[8] = {'J', 'N', 'P', 'P', 'O', 'S', 'E', 'T'};
+    const uint64_t FILE_VERSION = 1;
+
+    //Poset odczytany z pliku - wskaźniki do tablic opisanych przy
+    //file_header_t.
+    struct saved_poset_t {
+        uint64_t elements;
+        const uint64_t *name_offsets;
+        const uint64_t *cover_offsets;
+        const uint64_t *cover_targets;
+        const char *names;
+    };
+
+    void write_words(std::ofstream &file, const uint64_t *words, size_t count) {
+        file.write(reinterpret_cast<const char *>(words), count * sizeof(uint64_t));
+    }
+
+    //Zapisuje diagram Hassego i nazwy elementów posetu do pliku path.
+    //Zwraca false, jeżeli zapis się nie udał.
+    bool save_poset(poset_t &p, const char *path) {
+        std::vector<uint64_t> order;
+        topological_order(p, order);
+        std::vector<uint64_t> position(p.next_id);
+        file_header_t header;
+        std::copy_n(FILE_MAGIC, sizeof(header.magic), header.magic);
+        header.version = FILE_VERSION;
+        header.elements = order.size();
+        header.covers = 0;
+        header.name_bytes = 0;
+        for (size_t i = 0; i < order.size(); ++i) {
+            position[order[i]] = i;
+            header.covers += p.cover_successors[order[i]].size();
+            header.name_bytes += strlen(p.names[order[i]]) + 1;
+        }
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        std::vector<uint64_t> offsets(order.size() + 1, 0);
+        for (size_t i = 0; i + 1 < order.size(); ++i) {
+            offsets[i + 1] = offsets[i] + strlen(p.names[order[i]]) + 1;
+        }
+        write_words(file, offsets.data(), order.size());
+        std::vector<uint64_t> targets;
+        targets.reserve(header.covers);
+        for (size_t i = 0; i < order.size(); ++i) {
+            for (uint64_t w : p.cover_successors[order[i]]) {
+                targets.push_back(position[w]);
+            }
+            offsets[i + 1] = targets.size();
+            std::sort(targets.begin() + offsets[i], targets.end());
+        }
+        write_words(file, offsets.data(), order.size() + 1);
+        write_words(file, targets.data(), targets.size());
+        for (uint64_t v : order) {
+            file.write(p.names[v], strlen(p.names[v]) + 1);
+        }
+        file.close();
+        return !file.fail();
+    }
+
+    //Wczytuje cały plik path do buffer, wyrównanego do 8 bajtów, i zapisuje
+    //w bytes jego długość. Zwraca false, jeżeli pliku nie da się przeczytać.
+    bool read_file(const char *path, std::vector<uint64_t> &buffer, size_t &bytes) {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        std::streamoff size = file.tellg();
+        if (!file || size < 0) {
             return false;
         }
-        if (!poset_exists(id)) {
-            if (debug) {
-                std::cerr << "poset_test: poset " << id << " does not exist\n";
+        bytes = size;
+        buffer.assign((bytes + sizeof(uint64_t) - 1) / sizeof(uint64_t), 0);
+        file.seekg(0);
+        return file.read(reinterpret_cast<char *>(buffer.data()), size).good();
+    }
+
+    //Sprawdza, czy bytes bajtów z buffer to poprawny plik zapisany przez
+    //poset_save, i jeśli tak, wypełnia saved. Pokrycia prowadzące w górę
+    //porządku gwarantują brak cykli, a nazwy nie mogą się powtarzać.
+    //Nie sprawdzamy, czy żadne pokrycie nie wynika z pozostałych, bo nie da
+    //się tego zrobić w jednym liniowym przejściu - plik ma pochodzić
+    //z poset_save. Nadmiarowe pokrycie nie narusza pamięci, ale poset_del
+    //może je potem usunąć, choć między jego elementami leży inny element.
+    bool parse_saved_poset(const std::vector<uint64_t> &buffer, size_t bytes, saved_poset_t &saved) {
+        file_header_t header;
+        if (bytes < sizeof(header)) {
+            return false;
+        }
+        std::memcpy(&header, buffer.data(), sizeof(header));
+        size_t words = bytes / sizeof(uint64_t);
+        if (!std::equal(FILE_MAGIC, FILE_MAGIC + sizeof(header.magic), header.magic)
+            || header.version != FILE_VERSION || header.elements >= words || header.covers >= words
+            || header.name_bytes > bytes
+            || sizeof(header) + (2 * header.elements + 1 + header.covers) * sizeof(uint64_t) + header.name_bytes
+               != bytes) {
+            return false;
+        }
+        uint64_t n = header.elements;
+        saved.elements = n;
+        saved.name_offsets = buffer.data() + sizeof(header) / sizeof(uint64_t);
+        saved.cover_offsets = saved.name_offsets + n;
+        saved.cover_targets = saved.cover_offsets + n + 1;
+        saved.names = reinterpret_cast<const char *>(saved.cover_targets + header.covers);
+
+        uint64_t name_end = 0;
+        std::unordered_set<std::string_view> seen;
+        seen.reserve(n);
+        for (uint64_t i = 0; i < n; ++i) {
+            uint64_t offset = saved.name_offsets[i];
+            if (offset != name_end || offset >= header.name_bytes) {
+                return false;
             }
+            const char *name = saved.names + offset;
+            const char *end = std::find(name, saved.names + header.name_bytes, '\0');
+            if (end == saved.names + header.name_bytes || !seen.emplace(name, end - name).second) {
+                return false;
+            }
+            name_end = end - saved.names + 1;
+        }
+        if (name_end != header.name_bytes || saved.cover_offsets[0] != 0 || saved.cover_offsets[n] != header.covers) {
             return false;
         }
-        string_id_map_t &m = string_maps[id].first;
+        for (uint64_t i = 0; i < n; ++i) {
+            uint64_t previous = i;
+            if (saved.cover_offsets[i + 1] < saved.cover_offsets[i]
+                || saved.cover_offsets[i + 1] > header.covers) {
+                return false;
+            }
+            for (uint64_t j = saved.cover_offsets[i]; j < saved.cover_offsets[i + 1]; ++j) {
+                if (saved.cover_targets[j] <= previous || saved.cover_targets[j] >= n) {
+                    return false;
+                }
+                previous = saved.cover_targets[j];
+            }
+        }
+        return true;
+    }
+
+    //Zastępuje zawartość posetu posetem odczytanym z pliku. Elementy
+    //dostają identyfikatory w kolejności z pliku, a pokrycia trafiają wprost
+    //do setów, więc nic nie jest przeliczane poza domknięciem, które
+    //make_closure buduje raz, jeżeli poset nie jest w trybie diagramu
+    //Hassego.
+    void load_poset(poset_t &p, const saved_poset_t &saved) {
+        bool hasse = p.hasse;
+        clear_poset(p);
+        p.hasse = true;
+        p.dense = false;
+        p.element_ids.reserve(saved.elements);
+        p.names.reserve(saved.elements);
+        p.cover_successors.reserve(saved.elements);
+        p.cover_predecessors.reserve(saved.elements);
+        for (uint64_t i = 0; i < saved.elements; ++i) {
+            new_element(p, saved.names + saved.name_offsets[i]);
+        }
+        for (uint64_t i = 0; i < saved.elements; ++i) {
+            for (uint64_t j = saved.cover_offsets[i]; j < saved.cover_offsets[i + 1]; ++j) {
+                add_cover(p, i, saved.cover_targets[j]);
+            }
+        }
+        if (!hasse) {
+            make_closure(p);
+        }
+    }
+}
+
+namespace jnp1 {
+    uint32_t poset_new() {
+        TRACE("poset_new()");
+        poset_table_t &table = get_poset_table();
+        std::unique_lock<std::mutex> table_lock(table.mutex);
+        uint32_t slot;
+        if (!table.free_slots.empty()) {
+            slot = table.free_slots.front();
+            table.free_slots.pop_front();
+        } else if (table.used_slots < SLOT_MASK) {
+            slot = table.used_slots++;
+            if (slot % CHUNK_SIZE == 0) {
+                table.chunks[slot >> CHUNK_BITS].store(new poset_t[CHUNK_SIZE], std::memory_order_release);
+            }
+        } else {
+            TRACE("poset_new: too many posets");
+            return UINT32_MAX;
+        }
+        table_lock.unlock();
+
+        poset_t &p = table.chunks[slot >> CHUNK_BITS].load(std::memory_order_acquire)[slot & (CHUNK_SIZE - 1)];
+        write_lock_t lock(p.mutex);
+        p.alive = true;
+        uint32_t id = slot | p.generation << SLOT_BITS;
+        TRACE("poset_new: poset ", id, " created");
+        return id;
+    }
+
+    void poset_delete(uint32_t id) {
+        TRACE("poset_delete(", id, ")");
+
+        write_lock_t lock;
+        poset_t *p = lock_poset(id, lock);
+        if (p != nullptr) {
+            clear_poset(*p);
+            p->hasse = false;
+            p->dense = true;
+            p->alive = false;
+            if (p->generation == MAX_GENERATION) {
+                TRACE("poset_delete: poset ", id, " deleted, slot retired");
+                return;
+            }
+            ++p->generation;
+            lock.unlock();
+            poset_table_t &table = get_poset_table();
+            std::lock_guard<std::mutex> table_lock(table.mutex);
+            table.free_slots.push_back(id & SLOT_MASK);
+            TRACE("poset_delete: poset ", id, " deleted");
+            return;
+        }
+        TRACE("poset_delete: poset ", id, " does not exist");
+        return;
+    }
+
+    size_t poset_size(uint32_t id) {
+        TRACE("poset_size(", id, ")");
+
+        read_lock_t lock;
+        poset_t *p = lock_poset(id, lock);
+        if (p != nullptr) {
+            size_t s = p->element_ids.size();
+            TRACE("poset_size: poset ", id, " contains ", s, " elements");
+            return s;
+        }
+        TRACE("poset_size: poset ", id, " does not exist");
+        return 0;
+    }
+
+    bool poset_insert(uint32_t id, const char *value) {
+        TRACE("poset_insert(", id, ", ", quoted{value}, ")");
+
+        if (!value) {
+            TRACE("poset_insert: invalid value (NULL)");
+            return false;
+        }
+        write_lock_t lock;
+        poset_t *p = lock_poset(id, lock);
+        if (p == nullptr) {
+            TRACE("poset_insert: poset ", id, " does not exist");
+            return false;
+        }
+        string_id_map_t &m = p->element_ids;
+        if (m.count(value)) {
+            TRACE("poset_insert: poset ", id, ", element ", quoted{value}, " already exists");
+            return false;
+        }
+        poset_t &posets_id = *p;
+        new_element(posets_id, value);
+        choose_representation(posets_id);
+        TRACE("poset_insert: poset ", id, ", element ", quoted{value}, " inserted");
+        return true;
+    }
+
+    bool poset_test(uint32_t id, const char *value1, const char *value2) {
+        TRACE("poset_test(", id, ", ", quoted{value1}, ", ", quoted{value2}, ")");
+
+        if (!value1 || !value2) {
+            if (!value1) {
+                TRACE("poset_test: invalid value1 (NULL)");
+            }
+            if (!value2) {
+                TRACE("poset_test: invalid value2 (NULL)");
+            }
+            return false;
+        }
+        read_lock_t lock;
+        poset_t *p = lock_poset(id, lock);
+        if (p == nullptr) {
+            TRACE("poset_test: poset ", id, " does not exist");
+            return false;
+        }
+        string_id_map_t &m = p->element_ids;
         if (m.count(value1) == 0
             || m.count(value2) == 0) {
-            if (debug) {
-                std::cerr << "poset_test: poset " << id << ", element \"";
-                std::cerr << value1 << "\" or \"" << value2 << "\" does not exist\n";
-            }
+            TRACE("poset_test: poset ", id, ", element ", quoted{value1}, " or ", quoted{value2}, " does not exist");
             return false;
         }
         bool relation_exitst = false;
         if (same_value(value1, value2)) {
             relation_exitst = true;
         } else {
-            uint64_t v1 = m[value1];
-            uint64_t v2 = m[value2];
-            neighbours_set_t &outgoing = posets[id][v1];
-            if (outgoing.find(v2) != outgoing.end()) {
+            uint64_t v1 = m.at(value1);
+            uint64_t v2 = m.at(value2);
+            if (relation_test(*p, v1, v2)) {
                 relation_exitst = true;
             }
         }
-        if (debug) {
-            std::cerr << "poset_test: poset " << id << ", relation (\"";
-            std::cerr << value1 << "\", \"" << value2 << "\") ";
-            if (relation_exitst) {
-                std::cerr << "exists\n";
-            } else {
-                std::cerr << "does not exist\n";
+        TRACE("poset_test: poset ", id, ", relation (", quoted{value1}, ", ", quoted{value2}, ") ",
+              relation_exitst ? "exists" : "does not exist");
+        return relation_exitst;
+    }
+
+    size_t poset_insert_many(uint32_t id, const char *const *values, size_t count) {
+        TRACE("poset_insert_many(", id, ", ", count, " values)");
+
+        write_lock_t lock;
+        poset_t *p = lock_poset(id, lock);
+        if (p == nullptr) {
+            TRACE("poset_insert_many: poset ", id, " does not exist");
+            return 0;
+        }
+        poset_t &posets_id = *p;
+        string_id_map_t &m = p->element_ids;
+        size_t inserted = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (!values[i]) {
+                continue;
+            }
+            if (m.count(values[i]) == 0) {
+                new_element(posets_id, values[i]);
+                choose_representation(posets_id);
+                ++inserted;
             }
         }
-        return relation_exitst;
+        TRACE("poset_insert_many: poset ", id, ", ", inserted, " elements inserted");
+        return inserted;
     }
 
-    bool poset_add(uint32_t id, char const *value1, char const *value2) {
-        cerr_init();
-        if (debug) {
-            std::cerr << "poset_add(" << id << ", ";
-            if (!value1) std::cerr << "NULL, ";
-            else std::cerr << "\"" << value1 << "\", ";
-            if (!value2) std::cerr << "NULL)\n";
-            else std::cerr << "\"" << value2 << "\")\n";
-        }
-        std::unordered_map <uint32_t, poset_t> &posets = get_posets();
-        std::unordered_map <uint32_t, poset_t> &transposed = get_transposed();
-        std::unordered_map <uint32_t, std::pair<string_id_map_t, uint64_t>> &string_maps = get_string_map();
+    size_t poset_test_many(uint32_t id, const char *const *values1, const char *const *values2, size_t count,
+                           bool *results) {
+        TRACE("poset_test_many(", id, ", ", count, " pairs)");
 
-        if (!value1 || !value2) {
-            if (debug && !value1) {
-                std::cerr << "poset_add: invalid value1 (NULL)\n";
+        std::fill_n(results, count, false);
+        read_lock_t lock;
+        poset_t *p = lock_poset(id, lock);
+        if (p == nullptr) {
+            TRACE("poset_test_many: poset ", id, " does not exist");
+            return 0;
+        }
+        poset_t &posets_id = *p;
+        string_id_map_t &m = p->element_ids;
+        size_t related = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (!values1[i] || !values2[i]) {
+                continue;
             }
-            if (debug && !value2) {
-                std::cerr << "poset_add: invalid value2 (NULL)\n";
+            auto it1 = m.find(values1[i]);
+            auto it2 = m.find(values2[i]);
+            if (it1 == m.end() || it2 == m.end()) {
+                continue;
             }
+            results[i] = it1 == it2 || relation_test(posets_id, it1->second, it2->second);
+            related += results[i];
+        }
+        TRACE("poset_test_many: poset ", id, ", ", related, " pairs in relation");
+        return related;
+    }
+
+    bool poset_add_many(uint32_t id, const char *const *values1, const char *const *values2, size_t count) {
+        TRACE("poset_add_many(", id, ", ", count, " pairs)");
+
+        write_lock_t lock;
+        poset_t *p = lock_poset(id, lock);
+        if (p == nullptr) {
+            TRACE("poset_add_many: poset ", id, " does not exist");
             return false;
         }
-        if (!poset_exists(id)) {
-            if (debug) {
-                std::cerr << "poset_add: poset " << id << " does not exist\n";
+        poset_t &posets_id = *p;
+        string_id_map_t &m = p->element_ids;
+        std::vector<relation_t> relations;
+        relations.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            auto it1 = values1[i] ? m.find(values1[i]) : m.end();
+            auto it2 = values2[i] ? m.find(values2[i]) : m.end();
+            if (it1 == m.end() || it2 == m.end()) {
+                TRACE("poset_add_many: poset ", id, ", pair ", i, " has an invalid element");
+                return false;
             }
+            relations.emplace_back(it1->second, it2->second);
+        }
+        if (!add_relations(posets_id, relations)) {
+            TRACE("poset_add_many: poset ", id, ", relation not extended");
             return false;
         }
-        string_id_map_t &m = string_maps[id].first;
-        if (m.count(value1) == 0
-            || m.count(value2) == 0) {
-            if (debug) {
-                std::cerr << "poset_add: poset " << id << ", element \"";
-                std::cerr << value1 << "\" or \"" << value2 << "\" does not exist\n";
+        choose_representation(posets_id);
+        TRACE("poset_add_many: poset ", id, ", relations added");
+        return true;
+    }
+
+    bool poset_add(uint32_t id, char const *value1, char const *value2) {
+        TRACE("poset_add(", id, ", ", quoted{value1}, ", ", quoted{value2}, ")");
+
+        if (!value1 || !value2) {
+            if (!value1) {
+                TRACE("poset_add: invalid value1 (NULL)");
+            }
+            if (!value2) {
+                TRACE("poset_add: invalid value2 (NULL)");
             }
             return false;
         }
-        if (poset_test_internal(id, value1, value2) || poset_test_internal(id, value2, value1)) {
-            if (debug) {
-                std::cerr << "poset_add: poset " << id << ", relation (\"";
-                std::cerr << value1 << "\", \"" << value2 << "\") cannot be added3\n";
-            }
+        write_lock_t lock;
+        poset_t *p = lock_poset(id, lock);
+        if (p == nullptr) {
+            TRACE("poset_add: poset ", id, " does not exist");
             return false;
         }
-        poset_t &transposed_id = transposed[id];
-        uint64_t v1 = m[value1];
-        uint64_t v2 = m[value2];
-        posets[id][v1].insert(v2);
-        transposed_id[v2].insert(v1);
-        transitive_closure(id, v1, v2);
-        neighbours_set_t &incoming = transposed_id[v1];
-        for (auto it = incoming.begin(); it != incoming.end(); ++it) {
-            transitive_closure(id, *it, v1);
+        string_id_map_t &m = p->element_ids;
+        if (m.count(value1) == 0
+            || m.count(value2) == 0) {
+            TRACE("poset_add: poset ", id, ", element ", quoted{value1}, " or ", quoted{value2}, " does not exist");
+            return false;
         }
-        if (debug) {
-            std::cerr << "poset_add: poset " << id << ", relation (\"";
-            std::cerr << value1 << "\", \"" << value2 << "\") added\n";
+        if (!add_relation(*p, m.at(value1), m.at(value2))) {
+            TRACE("poset_add: poset ", id, ", relation (", quoted{value1}, ", ", quoted{value2},
+                  ") cannot be added");
+            return false;
         }
+        TRACE("poset_add: poset ", id, ", relation (", quoted{value1}, ", ", quoted{value2}, ") added");
         return true;
     }
 
     bool poset_del(uint32_t id, char const *value1, char const *value2) {
-        cerr_init();
-        if (debug) {
-            std::cerr << "poset_del(" << id << ", ";
-            if (!value1) std::cerr << "NULL, ";
-            else std::cerr << "\"" << value1 << "\", ";
-            if (!value2) std::cerr << "NULL)\n";
-            else std::cerr << "\"" << value2 << "\")\n";
-        }
-        std::unordered_map <uint32_t, poset_t> &posets = get_posets();
-        std::unordered_map <uint32_t, poset_t> &transposed = get_transposed();
-        std::unordered_map <uint32_t, std::pair<string_id_map_t, uint64_t>> &string_maps = get_string_map();
+        TRACE("poset_del(", id, ", ", quoted{value1}, ", ", quoted{value2}, ")");
 
         if (!value1 || !value2) {
-            if (debug && !value1) {
-                std::cerr << "poset_del: invalid value1 (NULL)\n";
+            if (!value1) {
+                TRACE("poset_del: invalid value1 (NULL)");
             }
-            if (debug && !value2) {
-                std::cerr << "poset_del: invalid value2 (NULL)\n";
+            if (!value2) {
+                TRACE("poset_del: invalid value2 (NULL)");
             }
             return false;
         }
-        if (!poset_exists(id)) {
-            if (debug) {
-                std::cerr << "poset_del: poset " << id << " does not exist\n";
-            }
+        write_lock_t lock;
+        poset_t *p = lock_poset(id, lock);
+        if (p == nullptr) {
+            TRACE("poset_del: poset ", id, " does not exist");
             return false;
         }
-        string_id_map_t &m = string_maps[id].first;
+        string_id_map_t &m = p->element_ids;
         if (m.count(value1) == 0
             || m.count(value2) == 0) {
-            if (debug) {
-                std::cerr << "poset_del: poset " << id << ", element \"";
-                std::cerr << value1 << "\" or \"" << value2 << "\" does not exist\n";
-            }
+            TRACE("poset_del: poset ", id, ", element ", quoted{value1}, " or ", quoted{value2}, " does not exist");
             return false;
         }
-        bool can_be_deleted = true;
-        if (!poset_test_internal(id, value1, value2) || same_value(value1, value2)) {
-            can_be_deleted = false;
-        } else {
-            uint64_t v1 = m[value1];
-            uint64_t v2 = m[value2];
-            if (longer_path(id, v1, v2)) {
-                can_be_deleted = false;
-            } else {
-                posets[id][v1].erase(v2);
-                transposed[id][v2].erase(v1);
-            }
+        bool can_be_deleted = remove_relation(*p, m.at(value1), m.at(value2));
+        TRACE("poset_del: poset ", id, ", relation (", quoted{value1}, ", ", quoted{value2}, ") ",
+              can_be_deleted ? "deleted" : "cannot be deleted");
+        return can_be_deleted;
+    }
+
+    uint64_t poset_lookup(uint32_t id, const char *value) {
+        TRACE("poset_lookup(", id, ", ", quoted{value}, ")");
+
+        if (!value) {
+            TRACE("poset_lookup: invalid value (NULL)");
+            return POSET_INVALID_HANDLE;
         }
-        if (debug) {
-            std::cerr << "poset_del: poset " << id << ", relation (\"";
-            std::cerr << value1 << "\", \"" << value2 << "\") ";
-            if (can_be_deleted) {
-                std::cerr << "deleted\n";
-            } else {
-                std::cerr << "cannot be deleted\n";
-            }
+        read_lock_t lock;
+        poset_t *p = lock_poset(id, lock);
+        if (p == nullptr) {
+            TRACE("poset_lookup: poset ", id, " does not exist");
+            return POSET_INVALID_HANDLE;
         }
-        return can_be_deleted;
+        string_id_map_t &m = p->element_ids;
+        auto it = m.find(value);
+        if (it == m.end()) {
+            TRACE("poset_lookup: poset ", id, ", element ", quoted{value}, " does not exist");
+            return POSET_INVALID_HANDLE;
+        }
+        TRACE("poset_lookup: poset ", id, ", element ", quoted{value}, " has handle ", it->second);
+        return it->second;
     }
 
-    bool poset_remove(uint32_t id, const char *value) {
-        cerr_init();
-        if (debug) {
-            std::cerr << "poset_remove(" << id << ", ";
-            if (!value) std::cerr << "NULL" << ")\n";
-            else std::cerr << "\"" << value << "\")\n";
+    bool poset_test_h(uint32_t id, uint64_t handle1, uint64_t handle2) {
+        TRACE("poset_test_h(", id, ", ", handle1, ", ", handle2, ")");
+
+        read_lock_t lock;
+        poset_t *p = lock_poset(id, lock);
+        if (p == nullptr) {
+            TRACE("poset_test_h: poset ", id, " does not exist");
+            return false;
+        }
+        poset_t &posets_id = *p;
+        if (!valid_element(posets_id, handle1) || !valid_element(posets_id, handle2)) {
+            TRACE("poset_test_h: poset ", id, ", handle ", handle1, " or ", handle2, " does not exist");
+            return false;
+        }
+        bool result = handle1 == handle2 || relation_test(posets_id, handle1, handle2);
+        TRACE("poset_test_h: poset ", id, ", relation (", handle1, ", ", handle2, ") ",
+              result ? "exists" : "does not exist");
+        return result;
+    }
+
+    bool poset_add_h(uint32_t id, uint64_t handle1, uint64_t handle2) {
+        TRACE("poset_add_h(", id, ", ", handle1, ", ", handle2, ")");
+
+        write_lock_t lock;
+        poset_t *p = lock_poset(id, lock);
+        if (p == nullptr) {
+            TRACE("poset_add_h: poset ", id, " does not exist");
+            return false;
+        }
+        poset_t &posets_id = *p;
+        if (!valid_element(posets_id, handle1) || !valid_element(posets_id, handle2)) {
+            TRACE("poset_add_h: poset ", id, ", handle ", handle1, " or ", handle2, " does not exist");
+            return false;
+        }
+        bool result = add_relation(posets_id, handle1, handle2);
+        TRACE("poset_add_h: poset ", id, ", relation (", handle1, ", ", handle2, ") ",
+              result ? "added" : "cannot be added");
+        return result;
+    }
+
+    bool poset_del_h(uint32_t id, uint64_t handle1, uint64_t handle2) {
+        TRACE("poset_del_h(", id, ", ", handle1, ", ", handle2, ")");
+
+        write_lock_t lock;
+        poset_t *p = lock_poset(id, lock);
+        if (p == nullptr) {
+            TRACE("poset_del_h: poset ", id, " does not exist");
+            return false;
+        }
+        poset_t &posets_id = *p;
+        if (!valid_element(posets_id, handle1) || !valid_element(posets_id, handle2)) {
+            TRACE("poset_del_h: poset ", id, ", handle ", handle1, " or ", handle2, " does not exist");
+            return false;
         }
-        std::unordered_map <uint32_t, poset_t> &posets = get_posets();
-        std::unordered_map <uint32_t, poset_t> &transposed = get_transposed();
-        std::unordered_map <uint32_t, std::pair<string_id_map_t, uint64_t>> &string_maps = get_string_map();
+        bool result = remove_relation(posets_id, handle1, handle2);
+        TRACE("poset_del_h: poset ", id, ", relation (", handle1, ", ", handle2, ") ",
+              result ? "deleted" : "cannot be deleted");
+        return result;
+    }
+
+    bool poset_remove(uint32_t id, const char *value) {
+        TRACE("poset_remove(", id, ", ", quoted{value}, ")");
 
         if (!value) {
-            if (debug) {
-                std::cerr << "poset_remove: invalid value (NULL)\n";
-            }
+            TRACE("poset_remove: invalid value (NULL)");
             return false;
         }
-        if (!poset_exists(id)) {
-            if (debug) {
-                std::cerr << "poset_remove: poset " << id << " does not exist\n";
-            }
+        write_lock_t lock;
+        poset_t *p = lock_poset(id, lock);
+        if (p == nullptr) {
+            TRACE("poset_remove: poset ", id, " does not exist");
             return false;
         }
-        string_id_map_t &m = string_maps[id].first;
+        string_id_map_t &m = p->element_ids;
         if (m.count(value) == 0) {
-            if (debug) {
-                std::cerr << "poset_remove: poset " << id << ", element \"";
-                std::cerr << value << "\" does not exist\n";
+            TRACE("poset_remove: poset ", id, ", element ", quoted{value}, " does not exist");
+            return false;
+        }
+
+        poset_t &posets_id = *p;
+        remove_element(posets_id, m.at(value));
+        choose_representation(posets_id);
+        TRACE("poset_remove: poset ", id, ", element ", quoted{value}, " removed");
+        return true;
+    }
+
+    bool poset_set_hasse(uint32_t id, bool hasse) {
+        TRACE("poset_set_hasse(", id, ", ", hasse, ")");
+
+        write_lock_t lock;
+        poset_t *p = lock_poset(id, lock);
+        if (p == nullptr) {
+            TRACE("poset_set_hasse: poset ", id, " does not exist");
+            return false;
+        }
+        if (hasse && !p->hasse) {
+            make_hasse(*p);
+        } else if (!hasse && p->hasse) {
+            make_closure(*p);
+        }
+        TRACE("poset_set_hasse: poset ", id, (hasse ? " stores its Hasse diagram" : " stores its closure"));
+        return true;
+    }
+
+    size_t poset_topo_order(uint32_t id, poset_visit_t visit, void *data) {
+        TRACE("poset_topo_order(", id, ")");
+
+        read_lock_t lock;
+        poset_t *p = lock_poset(id, lock);
+        if (p == nullptr) {
+            TRACE("poset_topo_order: poset ", id, " does not exist");
+            return 0;
+        }
+        std::vector<uint64_t> order;
+        topological_order(*p, order);
+        for (uint64_t v : order) {
+            visit(p->names[v], v, data);
+        }
+        TRACE("poset_topo_order: poset ", id, ", ", order.size(), " elements visited");
+        return order.size();
+    }
+
+    size_t poset_minimal(uint32_t id, poset_visit_t visit, void *data) {
+        TRACE("poset_minimal(", id, ")");
+
+        read_lock_t lock;
+        poset_t *p = lock_poset(id, lock);
+        if (p == nullptr) {
+            TRACE("poset_minimal: poset ", id, " does not exist");
+            return 0;
+        }
+        size_t visited = 0;
+        for (uint64_t v = 0; v < p->next_id; ++v) {
+            if (valid_element(*p, v) && p->cover_predecessors[v].empty()) {
+                visit(p->names[v], v, data);
+                ++visited;
             }
+        }
+        TRACE("poset_minimal: poset ", id, ", ", visited, " minimal elements");
+        return visited;
+    }
+
+    size_t poset_maximal(uint32_t id, poset_visit_t visit, void *data) {
+        TRACE("poset_maximal(", id, ")");
+
+        read_lock_t lock;
+        poset_t *p = lock_poset(id, lock);
+        if (p == nullptr) {
+            TRACE("poset_maximal: poset ", id, " does not exist");
+            return 0;
+        }
+        size_t visited = 0;
+        for (uint64_t v = 0; v < p->next_id; ++v) {
+            if (valid_element(*p, v) && p->cover_successors[v].empty()) {
+                visit(p->names[v], v, data);
+                ++visited;
+            }
+        }
+        TRACE("poset_maximal: poset ", id, ", ", visited, " maximal elements");
+        return visited;
+    }
+
+    size_t poset_layers(uint32_t id, poset_layer_visit_t visit, void *data) {
+        TRACE("poset_layers(", id, ")");
+
+        read_lock_t lock;
+        poset_t *p = lock_poset(id, lock);
+        if (p == nullptr) {
+            TRACE("poset_layers: poset ", id, " does not exist");
+            return 0;
+        }
+        std::vector<uint64_t> order;
+        std::vector<size_t> layer;
+        size_t layers = layered_order(*p, order, layer);
+        for (uint64_t v : order) {
+            visit(p->names[v], v, layer[v], data);
+        }
+        TRACE("poset_layers: poset ", id, ", ", layers, " layers");
+        return layers;
+    }
+
+    bool poset_save(uint32_t id, const char *path) {
+        TRACE("poset_save(", id, ", ", quoted{path}, ")");
+
+        if (!path) {
+            TRACE("poset_save: invalid path (NULL)");
+            return false;
+        }
+        read_lock_t lock;
+        poset_t *p = lock_poset(id, lock);
+        if (p == nullptr) {
+            TRACE("poset_save: poset ", id, " does not exist");
             return false;
         }
+        if (!save_poset(*p, path)) {
+            TRACE("poset_save: poset ", id, ", cannot write ", quoted{path});
+            return false;
+        }
+        TRACE("poset_save: poset ", id, " saved to ", quoted{path});
+        return true;
+    }
 
-        uint64_t v = m[value];
-        poset_t &posets_id = posets[id];
-        neighbours_set_t &outgoing = posets_id[v];
-        poset_t &transposed_id = transposed[id];
-        neighbours_set_t &incoming = transposed_id[v];
+    bool poset_load(uint32_t id, const char *path) {
+        TRACE("poset_load(", id, ", ", quoted{path}, ")");
 
-        for (auto it = outgoing.begin(); it != outgoing.end(); ++it) {
-            transposed_id[*it].erase(v);
+        if (!path) {
+            TRACE("poset_load: invalid path (NULL)");
+            return false;
         }
-        posets[id].erase(v);
-        for (auto it = incoming.begin(); it != incoming.end(); ++it) {
-            posets_id[*it].erase(v);
+        //Plik czytamy i sprawdzamy przed zablokowaniem posetu.
+        std::vector<uint64_t> buffer;
+        size_t bytes = 0;
+        saved_poset_t saved;
+        if (!read_file(path, buffer, bytes) || !parse_saved_poset(buffer, bytes, saved)) {
+            TRACE("poset_load: ", quoted{path}, " is not a saved poset");
+            return false;
         }
-        transposed_id.erase(v);
-        m.erase(value);
-        if (debug) {
-            std::cerr << "poset_remove: poset " << id << ", element \"";
-            std::cerr << value << "\" removed\n";
+        write_lock_t lock;
+        poset_t *p = lock_poset(id, lock);
+        if (p == nullptr) {
+            TRACE("poset_load: poset ", id, " does not exist");
+            return false;
         }
+        load_poset(*p, saved);
+        TRACE("poset_load: poset ", id, ", ", saved.elements, " elements loaded from ", quoted{path});
         return true;
     }
 
     void poset_clear(uint32_t id) {
-        cerr_init();
-        if (debug) {
-            std::cerr << "poset_clear(" << id << ")\n";
-        }
-        std::unordered_map <uint32_t, poset_t> &posets = get_posets();
-        std::unordered_map <uint32_t, poset_t> &transposed = get_transposed();
-        std::unordered_map <uint32_t, std::pair<string_id_map_t, uint64_t>> &string_maps = get_string_map();
-
-        if (poset_exists(id)) {
-            posets[id].clear();
-            transposed[id].clear();
-            std::pair <string_id_map_t, uint64_t> &string_map_id = string_maps[id];
-            string_map_id.first.clear();
-            string_map_id.second = 0;
-            if (debug) {
-                std::cerr << "poset_clear: poset " << id << " cleared\n";
-            }
-        } else if (debug) {
-            std::cerr << "poset_clear: poset " << id << " does not exist\n";
+        TRACE("poset_clear(", id, ")");
+
+        write_lock_t lock;
+        poset_t *p = lock_poset(id, lock);
+        if (p != nullptr) {
+            clear_poset(*p);
+            TRACE("poset_clear: poset ", id, " cleared");
+        } else {
+            TRACE("poset_clear: poset ", id, " does not exist");
         }
         return;
     }
@@ -14,7 +14,10 @@ namespace jnp1 {
 
 #endif
 
-//Tworzy nowy poset i zwraca jego identyfikator.
+//Tworzy nowy poset i zwraca jego identyfikator. Identyfikatory usuniętych
+//posetów nie są nadawane ponownie. Gdy wszystkie identyfikatory zostały już
+//wykorzystane, nie tworzy posetu i zwraca UINT32_MAX, który nie jest
+//identyfikatorem żadnego posetu.
 uint32_t poset_new();
 
 //Jeżeli istnieje poset o identyfikatorze id, usuwa go, a w przeciwnym
@@ -59,6 +62,104 @@ bool poset_del(uint32_t id, char const *value1, char const *value2);
 //wynikiem jest true, a w przeciwnym przypadku false.
 bool poset_test(uint32_t id, const char *value1, const char *value2);
 
+//Jeżeli istnieje poset o identyfikatorze id, dodaje do niego te spośród count
+//elementów tablicy values, które nie są NULL i nie należą jeszcze do zbioru,
+//a w przeciwnym przypadku nic nie robi. Wynikiem jest liczba dodanych
+//elementów.
+size_t poset_insert_many(uint32_t id, const char *const *values, size_t count);
+
+//Jeżeli istnieje poset o identyfikatorze id, wszystkie elementy values1[i]
+//i values2[i] (dla i < count) należą do tego zbioru, a rozszerzenie relacji
+//naraz o wszystkie pary (values1[i], values2[i]) i domknięcie jej przechodnio
+//daje częściowy porządek, to rozszerza relację w ten sposób, a w przeciwnym
+//przypadku nic nie robi. Pary, które już są w relacji, nie przeszkadzają.
+//Wynikiem jest true, gdy relacja została rozszerzona, a false w przeciwnym
+//przypadku.
+bool poset_add_many(uint32_t id, const char *const *values1, const char *const *values2, size_t count);
+
+//Dla każdego i < count zapisuje w results[i] wynik
+//poset_test(id, values1[i], values2[i]). Wynikiem jest liczba par, które są
+//w relacji.
+size_t poset_test_many(uint32_t id, const char *const *values1, const char *const *values2, size_t count,
+                       bool *results);
+
+//Wartość poset_lookup oznaczająca brak elementu
+#define POSET_INVALID_HANDLE ((uint64_t) -1)
+
+//Jeżeli istnieje poset o identyfikatorze id i element value należy do tego
+//zbioru, to wynikiem jest uchwyt tego elementu, a w przeciwnym przypadku
+//POSET_INVALID_HANDLE. Uchwyt jest ważny, dopóki element nie zostanie
+//usunięty z posetu ani poset nie zostanie wyczyszczony lub usunięty - potem
+//może zostać nadany innemu elementowi.
+uint64_t poset_lookup(uint32_t id, const char *value);
+
+//Działa jak poset_test dla elementów o uchwytach handle1 i handle2.
+bool poset_test_h(uint32_t id, uint64_t handle1, uint64_t handle2);
+
+//Działa jak poset_add dla elementów o uchwytach handle1 i handle2.
+bool poset_add_h(uint32_t id, uint64_t handle1, uint64_t handle2);
+
+//Działa jak poset_del dla elementów o uchwytach handle1 i handle2.
+bool poset_del_h(uint32_t id, uint64_t handle1, uint64_t handle2);
+
+//Jeżeli istnieje poset o identyfikatorze id, to dla hasse == true przełącza
+//go w tryb, w którym przechowuje tylko diagram Hassego relacji (pary
+//elementów, między którymi nie leży żaden inny), a dla hasse == false - z
+//powrotem w tryb z pełnym domknięciem przechodnim, i zwraca true.
+//W przeciwnym przypadku zwraca false. W trybie diagramu Hassego pamięć rośnie
+//liniowo z liczbą elementów i par diagramu, a poset_test korzysta z indeksu
+//osiągalności budowanego po zmianach posetu. Wyniki pozostałych funkcji nie
+//zależą od trybu. Tryb przetrwa poset_clear.
+bool poset_set_hasse(uint32_t id, bool hasse);
+
+//Funkcja wywoływana dla kolejnych elementów posetu: value to nazwa
+//elementu, handle - jego uchwyt, a data - wskaźnik przekazany przez
+//wywołującego. Jest wywoływana pod blokadą posetu, więc nie może go zmieniać.
+typedef void (*poset_visit_t)(const char *value, uint64_t handle, void *data);
+
+//Jak poset_visit_t, ale dostaje też numer warstwy layer elementu.
+typedef void (*poset_layer_visit_t)(const char *value, uint64_t handle, size_t layer, void *data);
+
+//Jeżeli istnieje poset o identyfikatorze id, wywołuje visit dla wszystkich
+//jego elementów w porządku topologicznym (każdy element przed elementami,
+//które poprzedza). Wynikiem jest liczba elementów, a dla nieistniejącego
+//posetu 0.
+size_t poset_topo_order(uint32_t id, poset_visit_t visit, void *data);
+
+//Jeżeli istnieje poset o identyfikatorze id, wywołuje visit dla jego
+//elementów minimalnych, czyli niepoprzedzanych przez żaden element.
+//Wynikiem jest liczba tych elementów, a dla nieistniejącego posetu 0.
+size_t poset_minimal(uint32_t id, poset_visit_t visit, void *data);
+
+//Jak poset_minimal, ale dla elementów maksymalnych, czyli niepoprzedzających
+//żadnego elementu.
+size_t poset_maximal(uint32_t id, poset_visit_t visit, void *data);
+
+//Jeżeli istnieje poset o identyfikatorze id, dzieli jego elementy na
+//warstwy i wywołuje visit dla wszystkich elementów warstwa po warstwie.
+//Warstwa 0 to elementy minimalne, a warstwa k > 0 - elementy, do których
+//najdłuższy łańcuch od elementu minimalnego ma k par. Elementy jednej
+//warstwy są parami nieporównywalne, a wszystkie elementy poprzedzające
+//element leżą w niższych warstwach. Wynikiem jest liczba warstw, a dla
+//nieistniejącego posetu 0.
+size_t poset_layers(uint32_t id, poset_layer_visit_t visit, void *data);
+
+//Jeżeli istnieje poset o identyfikatorze id, zapisuje jego elementy
+//i relację do pliku path w formacie binarnym i zwraca true, a w przeciwnym
+//przypadku lub gdy zapis się nie uda, zwraca false. Plik zawiera nazwy
+//elementów i diagram Hassego relacji, ale nie jej domknięcie.
+bool poset_save(uint32_t id, const char *path);
+
+//Jeżeli istnieje poset o identyfikatorze id, a path to plik zapisany przez
+//poset_save, zastępuje zawartość posetu zapisanymi elementami i relacją
+//i zwraca true, a w przeciwnym przypadku nic nie robi i zwraca false.
+//Poset zachowuje swój tryb (zob. poset_set_hasse), a uchwyty elementów
+//mogą się różnić od uchwytów w zapisanym posecie. poset_load sprawdza
+//budowę pliku, ale nie to, czy zapisane pary tworzą diagram Hassego, więc
+//dla pliku spoza poset_save zawierającego pary wynikające z innych wyniki
+//poset_del nie są określone.
+bool poset_load(uint32_t id, const char *path);
+
 //Jeżeli istnieje poset o identyfikatorze id, usuwa wszystkie jego elementy
 //oraz relacje między nimi, a w przeciwnym przypadku nic nie robi.
 void poset_clear(uint32_t id);
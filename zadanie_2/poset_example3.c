@@ -0,0 +1,58 @@
+#include "poset.h"
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+
+static void check_poset(unsigned long p) {
+    static const char *const from[] = {"A", "A", "A", "B", "D", "E", "X"};
+    static const char *const to[] = {"B", "D", "A", "C", "A", "D", "A"};
+    bool results[7];
+
+    assert(poset_size(p) == 5);
+    assert(poset_test_many(p, from, to, 7, results) == 3);
+    assert(results[0] && results[1] && results[2]);
+    assert(!results[3] && !results[4] && !results[5] && !results[6]);
+}
+
+int main() {
+    static const char *const values[] = {"A", "B", "C", "D", "E", "A", NULL};
+    static const char *const below[] = {"A", "A", "B", "C"};
+    static const char *const above[] = {"B", "C", "D", "D"};
+    static const char *const cycle[] = {"D", "B"};
+    static const char *const missing[] = {"X", "B"};
+    static const char *const sources[] = {"S", "T"};
+    static const char *const targets[] = {"W", "W"};
+    unsigned long p1, p2;
+
+    p1 = poset_new();
+    p2 = poset_new();
+
+    assert(poset_insert_many(p1, values, 7) == 5);
+    assert(poset_insert_many(p1, values, 7) == 0);
+    assert(poset_insert_many(p1 + 2, values, 7) == 0);
+    assert(poset_add_many(p1, below, above, 4));
+    assert(!poset_add_many(p1, below, above, 4));
+    assert(!poset_add_many(p1, cycle, below, 2));
+    assert(!poset_add_many(p1, missing, above, 2));
+    assert(!poset_add_many(p1 + 2, below, above, 4));
+    assert(!poset_add_many(p1, below, above, 0));
+    check_poset(p1);
+
+    assert(poset_insert(p2, "S"));
+    assert(poset_insert(p2, "T"));
+    assert(poset_insert(p2, "W"));
+    assert(poset_add(p2, "T", "S"));
+    assert(poset_add_many(p2, sources, targets, 2));
+    assert(!poset_del(p2, "T", "W"));
+    assert(poset_del(p2, "S", "W"));
+    assert(poset_test(p2, "T", "W"));
+    assert(poset_del(p2, "T", "W"));
+
+    poset_delete(p1);
+    poset_delete(p2);
+
+    return 0;
+}
@@ -0,0 +1,62 @@
+#include "poset.h"
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+
+int main() {
+    unsigned long p1;
+    uint64_t a, b, c;
+
+    p1 = poset_new();
+
+    assert(poset_lookup(p1, "A") == POSET_INVALID_HANDLE);
+    assert(poset_insert(p1, "A"));
+    assert(poset_insert(p1, "B"));
+    assert(poset_insert(p1, "C"));
+    a = poset_lookup(p1, "A");
+    b = poset_lookup(p1, "B");
+    c = poset_lookup(p1, "C");
+    assert(a != POSET_INVALID_HANDLE && b != POSET_INVALID_HANDLE && c != POSET_INVALID_HANDLE);
+    assert(a != b && b != c && a != c);
+    assert(poset_lookup(p1, "A") == a);
+    assert(poset_lookup(p1, "X") == POSET_INVALID_HANDLE);
+    assert(poset_lookup(p1 + 1, "A") == POSET_INVALID_HANDLE);
+
+    assert(poset_add_h(p1, a, b));
+    assert(!poset_add_h(p1, a, b));
+    assert(!poset_add_h(p1, b, a));
+    assert(!poset_add_h(p1, a, a));
+    assert(!poset_add_h(p1, a, POSET_INVALID_HANDLE));
+    assert(!poset_add_h(p1 + 1, b, c));
+    assert(poset_add_h(p1, b, c));
+    assert(poset_test_h(p1, a, c));
+    assert(poset_test(p1, "A", "C"));
+    assert(!poset_test_h(p1, c, a));
+    assert(poset_test_h(p1, a, a));
+    assert(!poset_test_h(p1, a, POSET_INVALID_HANDLE));
+    assert(!poset_test_h(p1 + 1, a, c));
+
+    assert(!poset_del_h(p1, a, c));
+    assert(!poset_del_h(p1 + 1, a, b));
+    assert(poset_del_h(p1, a, b));
+    assert(!poset_del_h(p1, a, b));
+    assert(!poset_test_h(p1, a, b));
+    assert(poset_test_h(p1, a, c));
+    assert(poset_del_h(p1, a, c));
+
+    assert(poset_remove(p1, "C"));
+    assert(poset_lookup(p1, "C") == POSET_INVALID_HANDLE);
+    assert(!poset_test_h(p1, b, c));
+    assert(poset_insert(p1, "D"));
+    assert(poset_lookup(p1, "D") != POSET_INVALID_HANDLE);
+    poset_clear(p1);
+    assert(poset_lookup(p1, "A") == POSET_INVALID_HANDLE);
+    assert(!poset_test_h(p1, a, a));
+    poset_delete(p1);
+    assert(!poset_test_h(p1, a, a));
+
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include "poset.h"
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+
+#define CHAIN 100
+
+static void check_poset(unsigned long p) {
+    assert(poset_size(p) == 4);
+    assert(poset_test(p, "A", "B"));
+    assert(poset_test(p, "A", "C"));
+    assert(!poset_test(p, "C", "A"));
+    assert(!poset_test(p, "A", "D"));
+    assert(!poset_test(p, "D", "A"));
+    assert(!poset_add(p, "A", "C"));
+    assert(!poset_add(p, "C", "A"));
+    assert(!poset_del(p, "A", "C"));
+}
+
+int main() {
+    unsigned long p1;
+    char name1[16], name2[16];
+    int i, j;
+
+    p1 = poset_new();
+
+    assert(poset_set_hasse(p1, true));
+    assert(poset_set_hasse(p1, true));
+    assert(!poset_set_hasse(p1 + 1, true));
+    assert(poset_insert(p1, "A"));
+    assert(poset_insert(p1, "B"));
+    assert(poset_insert(p1, "C"));
+    assert(poset_insert(p1, "D"));
+    assert(poset_add(p1, "A", "B"));
+    assert(poset_add(p1, "B", "C"));
+    check_poset(p1);
+
+    assert(poset_set_hasse(p1, false));
+    check_poset(p1);
+    assert(poset_set_hasse(p1, true));
+    check_poset(p1);
+
+    assert(poset_del(p1, "A", "B"));
+    assert(!poset_test(p1, "A", "B"));
+    assert(poset_test(p1, "A", "C"));
+    assert(poset_add(p1, "A", "B"));
+    check_poset(p1);
+    assert(poset_remove(p1, "B"));
+    assert(poset_test(p1, "A", "C"));
+    assert(poset_del(p1, "A", "C"));
+    assert(!poset_test(p1, "A", "C"));
+
+    poset_clear(p1);
+    for (i = 0; i < CHAIN; i++) {
+        snprintf(name1, sizeof(name1), "E%d", i);
+        assert(poset_insert(p1, name1));
+        if (i > 0) {
+            snprintf(name2, sizeof(name2), "E%d", i - 1);
+            assert(poset_add(p1, name2, name1));
+        }
+    }
+    for (i = 0; i < CHAIN; i++) {
+        for (j = 0; j < CHAIN; j++) {
+            snprintf(name1, sizeof(name1), "E%d", i);
+            snprintf(name2, sizeof(name2), "E%d", j);
+            assert(poset_test(p1, name1, name2) == (i <= j));
+        }
+    }
+    assert(!poset_del(p1, "E48", "E50"));
+    assert(poset_del(p1, "E49", "E50"));
+    assert(!poset_test(p1, "E49", "E50"));
+    assert(poset_test(p1, "E48", "E50"));
+    assert(poset_test(p1, "E0", "E99"));
+    assert(poset_del(p1, "E48", "E50"));
+    assert(!poset_test(p1, "E48", "E50"));
+
+    poset_delete(p1);
+    assert(!poset_set_hasse(p1, false));
+
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include "poset.h"
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+
+struct visited {
+    uint64_t handles[8];
+    size_t layers[8];
+    size_t count;
+};
+
+static void visit(const char *value, uint64_t handle, void *data) {
+    struct visited *v = data;
+    assert(value != NULL);
+    v->handles[v->count++] = handle;
+}
+
+static void visit_layer(const char *value, uint64_t handle, size_t layer, void *data) {
+    struct visited *v = data;
+    assert(value != NULL);
+    v->layers[v->count] = layer;
+    v->handles[v->count++] = handle;
+}
+
+static size_t position(const struct visited *v, uint64_t handle) {
+    size_t i;
+    for (i = 0; i < v->count && v->handles[i] != handle; i++);
+    return i;
+}
+
+static size_t layer(const struct visited *v, uint64_t handle) {
+    return v->layers[position(v, handle)];
+}
+
+static void check_orders(unsigned long p) {
+    uint64_t a = poset_lookup(p, "A");
+    uint64_t b = poset_lookup(p, "B");
+    uint64_t c = poset_lookup(p, "C");
+    uint64_t d = poset_lookup(p, "D");
+    uint64_t e = poset_lookup(p, "E");
+    struct visited v;
+
+    v.count = 0;
+    assert(poset_topo_order(p, visit, &v) == 5 && v.count == 5);
+    assert(position(&v, a) < position(&v, b) && position(&v, b) < position(&v, d));
+    assert(position(&v, a) < position(&v, c) && position(&v, c) < position(&v, d));
+    assert(position(&v, e) < 5);
+    v.count = 0;
+    assert(poset_minimal(p, visit, &v) == 2 && v.count == 2);
+    assert(position(&v, a) < 2 && position(&v, e) < 2);
+    v.count = 0;
+    assert(poset_maximal(p, visit, &v) == 2 && v.count == 2);
+    assert(position(&v, d) < 2 && position(&v, e) < 2);
+    v.count = 0;
+    assert(poset_layers(p, visit_layer, &v) == 3 && v.count == 5);
+    assert(layer(&v, a) == 0 && layer(&v, e) == 0);
+    assert(layer(&v, b) == 1 && layer(&v, c) == 1);
+    assert(layer(&v, d) == 2);
+    assert(position(&v, a) < position(&v, b) && position(&v, c) < position(&v, d));
+}
+
+int main() {
+    unsigned long p1;
+    struct visited v;
+
+    p1 = poset_new();
+
+    v.count = 0;
+    assert(poset_topo_order(p1, visit, &v) == 0);
+    assert(poset_minimal(p1, visit, &v) == 0);
+    assert(poset_maximal(p1, visit, &v) == 0);
+    assert(poset_layers(p1, visit_layer, &v) == 0);
+    assert(v.count == 0);
+    assert(poset_topo_order(p1 + 1, visit, &v) == 0);
+    assert(poset_minimal(p1 + 1, visit, &v) == 0);
+    assert(poset_maximal(p1 + 1, visit, &v) == 0);
+    assert(poset_layers(p1 + 1, visit_layer, &v) == 0);
+
+    assert(poset_insert(p1, "D"));
+    assert(poset_insert(p1, "C"));
+    assert(poset_insert(p1, "B"));
+    assert(poset_insert(p1, "A"));
+    assert(poset_insert(p1, "E"));
+    assert(poset_add(p1, "C", "D"));
+    assert(poset_add(p1, "B", "D"));
+    assert(poset_add(p1, "A", "C"));
+    assert(poset_add(p1, "A", "B"));
+    check_orders(p1);
+    assert(poset_set_hasse(p1, true));
+    check_orders(p1);
+
+    assert(poset_remove(p1, "B"));
+    assert(poset_remove(p1, "C"));
+    v.count = 0;
+    assert(poset_layers(p1, visit_layer, &v) == 2 && v.count == 3);
+    assert(layer(&v, poset_lookup(p1, "A")) == 0 && layer(&v, poset_lookup(p1, "E")) == 0);
+    assert(layer(&v, poset_lookup(p1, "D")) == 1);
+    v.count = 0;
+    assert(poset_maximal(p1, visit, &v) == 2);
+    poset_delete(p1);
+
+    return 0;
+}
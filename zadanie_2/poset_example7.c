@@ -0,0 +1,89 @@
+#include "poset.h"
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+
+#define FILE_NAME "poset_example7.bin"
+#define CORRUPT_FILE_NAME "poset_example7_corrupt.bin"
+#define MISSING_FILE_NAME "poset_example7_missing.bin"
+
+static void check_poset(unsigned long p) {
+    assert(poset_size(p) == 4);
+    assert(poset_test(p, "A", "B"));
+    assert(poset_test(p, "A", "C"));
+    assert(!poset_test(p, "C", "A"));
+    assert(!poset_test(p, "A", "D"));
+    assert(!poset_test(p, "D", "C"));
+    assert(!poset_del(p, "A", "C"));
+}
+
+static void copy_file(const char *from, const char *to, long skip) {
+    char buffer[4096];
+    size_t bytes;
+    FILE *file;
+
+    file = fopen(from, "rb");
+    assert(file != NULL);
+    bytes = fread(buffer, 1, sizeof(buffer), file);
+    fclose(file);
+    assert(bytes > (size_t) skip && bytes < sizeof(buffer));
+    file = fopen(to, "wb");
+    assert(file != NULL);
+    assert(fwrite(buffer, 1, bytes - skip, file) == bytes - skip);
+    fclose(file);
+}
+
+int main() {
+    unsigned long p1, p2, p3;
+
+    p1 = poset_new();
+    p2 = poset_new();
+    p3 = poset_new();
+
+    assert(poset_insert(p1, "A"));
+    assert(poset_insert(p1, "B"));
+    assert(poset_insert(p1, "C"));
+    assert(poset_insert(p1, "D"));
+    assert(poset_add(p1, "A", "B"));
+    assert(poset_add(p1, "B", "C"));
+    assert(poset_save(p1, FILE_NAME));
+    assert(!poset_save(p3 + 1, FILE_NAME));
+
+    assert(poset_insert(p2, "E"));
+    assert(poset_load(p2, FILE_NAME));
+    assert(!poset_test(p2, "E", "E"));
+    check_poset(p2);
+    assert(poset_del(p2, "B", "C"));
+    assert(poset_test(p1, "B", "C"));
+    assert(poset_set_hasse(p3, true));
+    assert(poset_load(p3, FILE_NAME));
+    check_poset(p3);
+    assert(!poset_load(p3 + 1, FILE_NAME));
+
+    copy_file(FILE_NAME, CORRUPT_FILE_NAME, 1);
+    assert(!poset_load(p1, CORRUPT_FILE_NAME));
+    assert(!poset_load(p3, CORRUPT_FILE_NAME));
+    assert(!poset_load(p1, MISSING_FILE_NAME));
+    check_poset(p1);
+    check_poset(p3);
+    copy_file(FILE_NAME, CORRUPT_FILE_NAME, 0);
+    assert(poset_load(p2, CORRUPT_FILE_NAME));
+    check_poset(p2);
+
+    poset_clear(p1);
+    assert(poset_save(p1, FILE_NAME));
+    assert(poset_load(p2, FILE_NAME));
+    assert(poset_size(p2) == 0);
+
+    remove(FILE_NAME);
+    remove(CORRUPT_FILE_NAME);
+    poset_delete(p1);
+    poset_delete(p2);
+    poset_delete(p3);
+
+    return 0;
+}